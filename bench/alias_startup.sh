@@ -0,0 +1,24 @@
+#!/bin/bash
+# Startup time with N aliases: text ~/.minishellrc versus the binary snapshot
+# Usage: bench/alias_startup.sh [count]
+COUNT=${1:-50000}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+gcc "$(dirname "$0")/../ex2.c" -o "$DIR/ex2" -O2 -Wall -pthread || exit 1
+
+for ((i = 0; i < COUNT; i++)); do
+    echo "alias a$i = 'echo $i'"
+done > "$DIR/.minishellrc"
+
+run() {
+    local start end
+    start=$(date +%s%N)
+    echo exit_shell | HOME="$DIR" "$DIR/ex2" > /dev/null
+    end=$(date +%s%N)
+    echo "$1: $(( (end - start) / 1000000 )) ms"
+}
+
+run "text rc ($COUNT aliases)"
+run "snapshot ($COUNT aliases)"
+run "snapshot ($COUNT aliases)"
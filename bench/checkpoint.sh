@@ -0,0 +1,30 @@
+#!/bin/bash
+# Checkpoint and restore time of a session with N aliases and a few running jobs
+# Usage: bench/checkpoint.sh [aliases]
+COUNT=${1:-100000}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+gcc "$(dirname "$0")/../ex2.c" -o "$DIR/ex2" -O2 -Wall -pthread || exit 1
+
+for ((i = 0; i < COUNT; i++)); do
+    echo "alias a$i = 'echo $i'"
+done > "$DIR/.minishellrc"
+# Write the alias snapshot once, so the checkpointing shell starts quickly
+echo exit_shell | HOME="$DIR" MINISHELL_HISTORY= "$DIR/ex2" > /dev/null
+
+ms() {
+    echo $(( ($(date +%s%N) - $1) / 1000000 ))
+}
+
+start=$(date +%s%N)
+printf 'sleep 5 &\nsleep 5 &\ncheckpoint %s\nexit_shell\n' "$DIR/session" |
+    HOME="$DIR" MINISHELL_HISTORY= "$DIR/ex2" > /dev/null 2>&1
+echo "start + checkpoint ($COUNT aliases): $(ms "$start") ms, $(stat -c %s "$DIR/session") bytes"
+
+# No snapshot for the restoring shell: the checkpoint is its only alias source
+for run in 1 2 3; do
+    start=$(date +%s%N)
+    out=$(echo exit_shell | MINISHELL_ALIASES= MINISHELL_HISTORY= "$DIR/ex2" --restore "$DIR/session" | head -1)
+    echo "restore run $run: $out (process $(ms "$start") ms)"
+done
@@ -0,0 +1,25 @@
+#!/bin/bash
+# Completion latency with N extra executables on PATH
+# Usage: bench/completion.sh [count]
+COUNT=${1:-20000}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+gcc "$(dirname "$0")/../ex2.c" -o "$DIR/ex2" -O2 -Wall -pthread || exit 1
+
+mkdir "$DIR/bin"
+for ((i = 0; i < COUNT; i++)); do
+    printf '%s\n' "$DIR/bin/tool$i"
+done | xargs touch
+chmod +x "$DIR"/bin/*
+
+# The first query waits for the background build, the rest hit the index
+{
+    echo "complete -t tool"
+    for ((i = 0; i < 5; i++)); do
+        echo "complete -t tool1"
+        echo "complete -t tool199"
+        echo "complete -t g"
+    done
+    echo "exit_shell"
+} | PATH="$DIR/bin:$PATH" MINISHELL_HISTORY= MINISHELL_ALIASES= "$DIR/ex2" | grep -o '[0-9]* matches in .*'
@@ -0,0 +1,40 @@
+#!/bin/bash
+# Exec-heavy script with 500 exported variables: cached envp versus one
+# rebuilt before every command (an exported variable changes on each line)
+# Usage: bench/env_exec.sh [count] [vars]
+COUNT=${1:-2000}
+VARS=${2:-500}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+gcc "$(dirname "$0")/../ex2.c" -o "$DIR/ex2" -O2 -Wall -pthread || exit 1
+
+exports() {
+    echo "#!/bin/bash"
+    for ((i = 0; i < VARS; i++)); do
+        echo "export BENCH_VAR_$i=value_$i"
+    done
+}
+
+{
+    exports
+    for ((i = 0; i < COUNT; i++)); do
+        echo "/bin/true"
+    done
+} > "$DIR/cached.sh"
+
+{
+    exports
+    for ((i = 0; i < COUNT; i++)); do
+        echo "export BENCH_STEP=$i"
+        echo "/bin/true"
+    done
+} > "$DIR/rebuilt.sh"
+
+for script in cached rebuilt; do
+    start=$(date +%s%N)
+    printf 'source %s\nexit_shell\n' "$DIR/$script.sh" |
+        MINISHELL_HISTORY= MINISHELL_ALIASES= "$DIR/ex2" > /dev/null
+    end=$(date +%s%N)
+    echo "$script: $COUNT execs with $VARS exported variables in $(( (end - start) / 1000000 )) ms"
+done
@@ -0,0 +1,28 @@
+#!/bin/bash
+# Repeated globs over one directory of N files, with and without the listing cache
+# Usage: bench/glob_cache.sh [files] [globs]
+FILES=${1:-100000}
+GLOBS=${2:-200}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+gcc "$(dirname "$0")/../ex2.c" -o "$DIR/ex2" -O2 -Wall -pthread || exit 1
+
+mkdir "$DIR/files"
+(cd "$DIR/files" && seq -f 'file_%.0f.txt' 0 $((FILES - 1)) | xargs touch)
+sleep 0.1  # let the directory's mtime age past the racy window
+
+{
+    echo "#!/bin/bash"
+    for ((i = 0; i < GLOBS; i++)); do
+        echo "echo $DIR/files/file_$((i % 100))?7.txt"
+    done
+} > "$DIR/bench.sh"
+
+for mode in -u -s; do
+    start=$(date +%s%N)
+    result=$(printf 'shopt %s globcache\nsource %s\nshopt\nexit_shell\n' "$mode" "$DIR/bench.sh" |
+        MINISHELL_HISTORY= MINISHELL_ALIASES= "$DIR/ex2" | grep -o 'globcache.*')
+    end=$(date +%s%N)
+    echo "$result: $GLOBS globs over $FILES files in $(( (end - start) / 1000000 )) ms"
+done
@@ -0,0 +1,49 @@
+#!/bin/bash
+# Syscalls per command of each I/O backend, stdio included, for a script of
+# N short commands. Counted from outside the shell with strace -c -f, or with
+# bench/syscount.c when strace is not installed; the in-shell iostat figures
+# are printed next to them.
+# Usage: bench/io_backends.sh [count]
+COUNT=${1:-2000}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+HERE=$(dirname "$0")
+
+gcc "$HERE/../ex2.c" -o "$DIR/ex2" -O2 -Wall -pthread || exit 1
+if ! command -v strace > /dev/null; then
+    gcc "$HERE/syscount.c" -o "$DIR/syscount" -O2 -Wall || exit 1
+fi
+
+{
+    echo "#!/bin/bash"
+    for ((i = 0; i < COUNT; i++)); do
+        echo "true"
+        echo "jobs"
+    done
+} > "$DIR/bench.sh"
+COMMANDS=$((2 * COUNT + 2))
+
+# Prints the total syscall count of the shell and its children
+count_syscalls() {
+    if command -v strace > /dev/null; then
+        strace -f -c -o "$DIR/strace.out" "$@" > "$DIR/out" 2> /dev/null
+        awk '$NF == "total" { print $4 }' "$DIR/strace.out"
+    else
+        "$DIR/syscount" "$@" > "$DIR/out" 2> "$DIR/count"
+        awk '/^syscalls:/ { print $2 + $4 " (shell " $2 ")" }' "$DIR/count"
+    fi
+}
+
+for backend in stdio epoll uring; do
+    start=$(date +%s%N)
+    printf 'source %s\niostat\nexit_shell\n' "$DIR/bench.sh" |
+        MINISHELL_HISTORY= MINISHELL_ALIASES= "$DIR/ex2" --io=$backend > "$DIR/out"
+    end=$(date +%s%N)
+    sed -n '/backend [a-z]*\( (.*)\)\?$/,/^read\/write/p' "$DIR/out" | sed 's/^.*> backend/backend/'
+    echo "wall $(( (end - start) / 1000000 )) ms"
+
+    total=$(printf 'source %s\niostat\nexit_shell\n' "$DIR/bench.sh" |
+        MINISHELL_HISTORY= MINISHELL_ALIASES= count_syscalls "$DIR/ex2" --io=$backend)
+    echo "traced syscalls $total, per command $(awk -v t="${total%% *}" -v c=$COMMANDS 'BEGIN { printf "%.1f", t / c }')"
+    echo
+done
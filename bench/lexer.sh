@@ -0,0 +1,51 @@
+#!/bin/bash
+# Tokenizes generated long command lines with each lexer implementation
+# Usage: bench/lexer.sh [line length] [iterations]
+LENGTH=${1:-1000}
+ITERATIONS=${2:-200000}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# The shell's main is renamed so a small driver can call lex_split directly
+cat > "$DIR/driver.c" <<DRIVER
+#define main shell_main
+#include "$(cd "$(dirname "$0")/.." && pwd)/ex2.c"
+#undef main
+
+int main() {
+    char line[$LENGTH + 64];
+    size_t used = 0;
+    const char* words[] = { "gcc", "-O2", "'quoted arg'", "&&", "\"two words\"", "file.c", "||", "2>", "err.log" };
+    for (int i = 0; used + 20 < sizeof(line) - 64; i++)
+        used += sprintf(line + used, "%s%s", i ? " " : "", words[i % 9]);
+    lex_init();
+    int best = lexImpl;
+    LexBlock blocks[sizeof(line) / 64 + 1];
+    LexMasks masks = { blocks, 0, 0 };
+    for (int impl = LEX_SCALAR; impl <= best; impl++) {
+        lexImpl = impl;
+        int count = 0;
+        LexInfo info;
+        int64_t start = now_ns(CLOCK_MONOTONIC);
+        for (int i = 0; i < $ITERATIONS; i++) {
+            char** words = lex_split(line, &count, &info);
+            free_split_string(words);
+        }
+        int64_t elapsed = now_ns(CLOCK_MONOTONIC) - start;
+        // The classification pass alone, without allocating the words
+        start = now_ns(CLOCK_MONOTONIC);
+        for (int i = 0; i < $ITERATIONS; i++) {
+            lex_classify(line, used, &masks);
+            __asm__ volatile("" : : "r"(blocks) : "memory");
+        }
+        int64_t classify = now_ns(CLOCK_MONOTONIC) - start;
+        printf("%-6s %zu bytes, %d words: split %.0f ns/line, classify %.0f ns/line (%.2f GB/s)\n",
+               lexImplNames[impl], used, count, (double)elapsed / $ITERATIONS, (double)classify / $ITERATIONS,
+               (double)used * $ITERATIONS / classify);
+    }
+    return 0;
+}
+DRIVER
+
+gcc "$DIR/driver.c" -o "$DIR/driver" -O2 -pthread || exit 1
+"$DIR/driver"
@@ -0,0 +1,41 @@
+#!/bin/bash
+# Script run time with and without read-ahead: N short foreground commands,
+# half of them through aliases, with a long PATH so lookups cost something
+# Usage: bench/readahead.sh [lines]
+COUNT=${1:-5000}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+gcc "$(dirname "$0")/../ex2.c" -o "$DIR/ex2" -O2 -Wall -pthread || exit 1
+
+LONGPATH=""
+for ((i = 0; i < 50; i++)); do
+    mkdir -p "$DIR/bin$i"
+    LONGPATH="$LONGPATH$DIR/bin$i:"
+done
+LONGPATH="$LONGPATH$PATH"
+
+{
+    echo '#!/bin/bash'
+    for ((i = 0; i < 20; i++)); do
+        echo "alias t$i='true -a -b -c $i'"
+    done
+    for ((i = 0; i < COUNT; i++)); do
+        if ((i % 2)); then
+            echo "t$((i % 20)) one two three four five six seven eight"
+        else
+            echo "true 'quoted $i' \"double $i\" plain words to split and copy"
+        fi
+    done
+    echo iostat
+} > "$DIR/script.sh"
+
+for depth in 0 8; do
+    for run in 1 2 3; do
+        start=$(date +%s%N)
+        out=$(printf 'source %s\nexit_shell\n' "$DIR/script.sh" |
+            PATH="$LONGPATH" MINISHELL_READAHEAD=$depth MINISHELL_ALIASES= MINISHELL_HISTORY= "$DIR/ex2" 2>&1 |
+            grep read-ahead)
+        echo "depth $depth run $run: $(( ($(date +%s%N) - start) / 1000000 )) ms ($out)"
+    done
+done
@@ -0,0 +1,35 @@
+#!/bin/bash
+# Memory of N idle shells holding the same aliases: private tables versus one shared segment
+# Usage: bench/shm_aliases.sh [shells] [aliases]
+SHELLS=${1:-8}
+COUNT=${2:-50000}
+DIR=$(mktemp -d)
+SEGMENT=/minishell-bench-$$
+trap 'rm -rf "$DIR"; rm -f /dev/shm$SEGMENT' EXIT
+
+gcc "$(dirname "$0")/../ex2.c" -o "$DIR/ex2" -O2 -Wall -pthread || exit 1
+
+for ((i = 0; i < COUNT; i++)); do
+    echo "alias a$i = 'echo $i'"
+done > "$DIR/.minishellrc"
+# Write the snapshot once so both runs start from it
+echo exit_shell | HOME="$DIR" MINISHELL_HISTORY= "$DIR/ex2" > /dev/null
+
+run() {
+    local pids=() pss=0
+    for ((i = 0; i < SHELLS; i++)); do
+        (sleep 2; echo exit_shell) | HOME="$DIR" MINISHELL_HISTORY= MINISHELL_SHM_ALIASES="$1" "$DIR/ex2" > /dev/null &
+        pids+=($!)
+        sleep 0.1
+    done
+    sleep 0.5
+    for pid in "${pids[@]}"; do
+        kb=$(awk '/^Pss:/ { print $2 }' "/proc/$pid/smaps_rollup" 2> /dev/null)
+        pss=$((pss + ${kb:-0}))
+    done
+    wait
+    echo "$2: $SHELLS shells, $COUNT aliases, total PSS $((pss / 1024)) MB"
+}
+
+run "" "private tables"
+run "$SEGMENT" "shared segment"
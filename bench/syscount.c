@@ -0,0 +1,98 @@
+// syscount: counts the syscalls of a command and of everything it starts,
+// split into the command's own process (all its threads) and its children.
+// bench/io_backends.sh uses it when strace is not installed.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#define MAX_PID 4194304
+
+unsigned char inSyscall[MAX_PID];   // between the entry and the exit stop
+unsigned char ownThread[MAX_PID];   // a thread of the traced command's process
+
+// Thread group of a task, from /proc
+pid_t task_tgid(pid_t tid) {
+    char path[64], line[128];
+    snprintf(path, sizeof(path), "/proc/%d/status", tid);
+    FILE* file = fopen(path, "r");
+    pid_t tgid = 0;
+    if (file == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, "Tgid:", 5) == 0) {
+            tgid = (pid_t)atoi(line + 5);
+            break;
+        }
+    }
+    fclose(file);
+    return tgid;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s command [args]\n", argv[0]);
+        return 2;
+    }
+    pid_t child = fork();
+    if (child == -1) {
+        perror("fork");
+        return 1;
+    }
+    if (child == 0) {
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        raise(SIGSTOP);
+        execvp(argv[1], argv + 1);
+        perror(argv[1]);
+        _exit(127);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE |
+                   PTRACE_O_TRACEEXEC;
+    ptrace(PTRACE_SETOPTIONS, child, NULL, (void*)options);
+    ptrace(PTRACE_SYSCALL, child, NULL, NULL);
+    ownThread[child] = 1;
+
+    long own = 0, children = 0;
+    int exitCode = 0;
+    for (;;) {
+        pid_t pid = waitpid(-1, &status, __WALL);
+        if (pid == -1)
+            break;
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (pid == child)
+                exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            inSyscall[pid] = 0;
+            continue;
+        }
+        int sig = 0;
+        int stop = WSTOPSIG(status);
+        int event = status >> 16;
+        if (stop == (SIGTRAP | 0x80)) {
+            // Count entries only; a new task starts outside a syscall
+            inSyscall[pid] ^= 1;
+            if (inSyscall[pid]) {
+                if (ownThread[pid])
+                    own++;
+                else
+                    children++;
+            }
+        } else if (event == PTRACE_EVENT_CLONE) {
+            unsigned long tid;
+            ptrace(PTRACE_GETEVENTMSG, pid, NULL, &tid);
+            if (tid < MAX_PID)
+                ownThread[tid] = ownThread[pid] && task_tgid((pid_t)tid) == child;
+        } else if (event == PTRACE_EVENT_EXEC) {
+            inSyscall[pid] = 1;   // the exit stop of execve follows
+        } else if (event == 0 && stop != SIGTRAP && stop != SIGSTOP) {
+            sig = stop;           // pass real signals on
+        }
+        ptrace(PTRACE_SYSCALL, pid, NULL, (void*)(long)sig);
+    }
+    fprintf(stderr, "syscalls: %ld own, %ld children\n", own, children);
+    return exitCode;
+}
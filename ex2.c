@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,99 +7,999 @@
 #include <signal.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sched.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <pthread.h>
+#include <termios.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <linux/io_uring.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <malloc.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "status_page.h"
+
+// String interning. Each distinct string is stored once together with its
+// hash, and the returned handle stays valid while it is referenced, so two
+// interned strings are equal exactly when the pointers are. Alias keys, job
+// commands and the command path cache use handles instead of strcmp.
+typedef struct InternEntry {
+    struct InternEntry* next;
+    unsigned int hash;
+    unsigned int len;
+    volatile int refs;
+    char text[];
+} InternEntry;
+
+typedef struct InternTable {
+    InternEntry** buckets;
+    unsigned int bucketCount;
+    unsigned int count;
+    size_t bytes;
+    unsigned long lookups;
+    unsigned long shared;            // lookups answered by an existing entry
+    volatile sig_atomic_t dead;      // entries dropped to zero refs by intern_drop
+} InternTable;
+
+InternTable interned = { NULL, 0, 0, 0, 0, 0, 0 };
+
+#define INTERN_ENTRY(atom) ((InternEntry*)((atom) - offsetof(InternEntry, text)))
+
+unsigned int intern_hash_text(const char* text, size_t len) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Precomputed hash of an interned string
+unsigned int intern_hash(const char* atom) {
+    return INTERN_ENTRY(atom)->hash;
+}
+
+InternEntry* intern_lookup(const char* text, size_t len, unsigned int hash) {
+    if (interned.buckets == NULL)
+        return NULL;
+    for (InternEntry* entry = interned.buckets[hash % interned.bucketCount]; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && entry->len == len && memcmp(entry->text, text, len) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+// The handle for text if it is interned, without taking a reference
+const char* intern_find(const char* text) {
+    size_t len = strlen(text);
+    InternEntry* entry = intern_lookup(text, len, intern_hash_text(text, len));
+    return entry != NULL && entry->refs > 0 ? entry->text : NULL;
+}
+
+void intern_grow() {
+    unsigned int newCount = interned.bucketCount ? interned.bucketCount * 2 : 256;
+    InternEntry** buckets = (InternEntry**)calloc(newCount, sizeof(InternEntry*));
+    if (buckets == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (unsigned int i = 0; i < interned.bucketCount; i++) {
+        InternEntry* entry = interned.buckets[i];
+        while (entry != NULL) {
+            InternEntry* next = entry->next;
+            entry->next = buckets[entry->hash % newCount];
+            buckets[entry->hash % newCount] = entry;
+            entry = next;
+        }
+    }
+    free(interned.buckets);
+    interned.buckets = buckets;
+    interned.bucketCount = newCount;
+}
+
+// Interns the first len bytes of text and takes a reference to the handle
+const char* intern_n(const char* text, size_t len) {
+    unsigned int hash = intern_hash_text(text, len);
+    interned.lookups++;
+    InternEntry* entry = intern_lookup(text, len, hash);
+    if (entry != NULL) {
+        if (__atomic_fetch_add(&entry->refs, 1, __ATOMIC_RELAXED) == 0)
+            __atomic_fetch_sub(&interned.dead, 1, __ATOMIC_RELAXED);  // revived before the sweep got to it
+        else
+            interned.shared++;
+        return entry->text;
+    }
+    if (interned.count >= interned.bucketCount * 2)
+        intern_grow();
+    entry = (InternEntry*)malloc(sizeof(InternEntry) + len + 1);
+    if (entry == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    entry->hash = hash;
+    entry->len = (unsigned int)len;
+    entry->refs = 1;
+    memcpy(entry->text, text, len);
+    entry->text[len] = '\0';
+    entry->next = interned.buckets[hash % interned.bucketCount];
+    interned.buckets[hash % interned.bucketCount] = entry;
+    interned.count++;
+    interned.bytes += sizeof(InternEntry) + len + 1;
+    return entry->text;
+}
+
+const char* intern(const char* text) {
+    return intern_n(text, strlen(text));
+}
+
+// Frees every entry nobody references any more
+void intern_sweep() {
+    for (unsigned int i = 0; i < interned.bucketCount; i++) {
+        InternEntry** link = &interned.buckets[i];
+        while (*link != NULL) {
+            InternEntry* entry = *link;
+            if (entry->refs == 0) {
+                *link = entry->next;
+                interned.count--;
+                interned.bytes -= sizeof(InternEntry) + entry->len + 1;
+                free(entry);
+            } else {
+                link = &entry->next;
+            }
+        }
+    }
+    interned.dead = 0;
+}
+
+// Drops a reference; the entry is freed right away
+void intern_release(const char* atom) {
+    InternEntry* entry = INTERN_ENTRY(atom);
+    if (__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_RELAXED) > 0)
+        return;
+    InternEntry** link = &interned.buckets[entry->hash % interned.bucketCount];
+    while (*link != entry)
+        link = &(*link)->next;
+    *link = entry->next;
+    interned.count--;
+    interned.bytes -= sizeof(InternEntry) + entry->len + 1;
+    free(entry);
+}
+
+// Drops a reference without touching the table, for the SIGCHLD handler;
+// the entry stays until intern_sweep (or is revived by the next intern)
+void intern_drop(const char* atom) {
+    if (__atomic_sub_fetch(&INTERN_ENTRY(atom)->refs, 1, __ATOMIC_RELAXED) == 0)
+        __atomic_fetch_add(&interned.dead, 1, __ATOMIC_RELAXED);
+}
+
+// Command path cache: interned command name -> resolved executable, so a
+// repeated command skips the PATH walk. Only hits are cached. An entry also
+// keeps the mtimes of the PATH directories up to the one it was found in and
+// is dropped when one of them changes, so a command installed earlier in PATH
+// takes over; a stale entry otherwise just makes the child's execve fail
+// over to execvpe.
+#define PATH_CACHE_BUCKETS 128
+
+typedef struct PathEntry {
+    const char* name;   // interned
+    char* path;
+    struct timespec* dirTimes;   // mtime of each PATH directory searched, {-1, -1} if missing
+    int dirCount;
+    struct PathEntry* next;
+} PathEntry;
+
+PathEntry* pathCache[PATH_CACHE_BUCKETS];
+unsigned long pathHits = 0, pathMisses = 0;
+unsigned long pathGeneration = 0;   // bumped when PATH changes
+
+void free_path_entry(PathEntry* entry) {
+    intern_release(entry->name);
+    free(entry->path);
+    free(entry->dirTimes);
+    free(entry);
+}
+
+void clear_path_cache() {
+    pathGeneration++;
+    for (int i = 0; i < PATH_CACHE_BUCKETS; i++) {
+        PathEntry* entry = pathCache[i];
+        while (entry != NULL) {
+            PathEntry* next = entry->next;
+            free_path_entry(entry);
+            entry = next;
+        }
+        pathCache[i] = NULL;
+    }
+}
+
+// The PATH directory of length dirLen at dir, as a path ("" is the cwd)
+void path_dir_name(const char* dir, size_t dirLen, char* out, size_t outSize) {
+    if (dirLen == 0)
+        snprintf(out, outSize, ".");
+    else
+        snprintf(out, outSize, "%.*s", (int)dirLen, dir);
+}
+
+struct timespec path_dir_time(const char* dir) {
+    struct stat st;
+    if (stat(dir, &st) != 0)
+        return (struct timespec){ -1, -1 };
+    return st.st_mtim;
+}
+
+// Whether a PATH directory the entry was looked up in has changed since
+int path_entry_stale(const PathEntry* entry) {
+    const char* path = getenv("PATH");
+    char dir[PATH_MAX];
+    for (int i = 0; i < entry->dirCount; i++) {
+        if (path == NULL || *path == '\0')
+            return 1;
+        const char* end = strchrnul(path, ':');
+        path_dir_name(path, end - path, dir, sizeof(dir));
+        struct timespec now = path_dir_time(dir);
+        if (now.tv_sec != entry->dirTimes[i].tv_sec || now.tv_nsec != entry->dirTimes[i].tv_nsec)
+            return 1;
+        path = *end == ':' ? end + 1 : end;
+    }
+    return 0;
+}
+
+// Remembers where name was found and the directory mtimes seen on the way
+const char* cache_command_path(const char* name, const char* path, const struct timespec* dirTimes, int dirCount) {
+    PathEntry* entry = (PathEntry*)malloc(sizeof(PathEntry));
+    char* copy = strdup(path);
+    struct timespec* times = (struct timespec*)malloc(dirCount * sizeof(struct timespec));
+    if (entry == NULL || copy == NULL || times == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(times, dirTimes, dirCount * sizeof(struct timespec));
+    entry->name = intern(name);
+    entry->path = copy;
+    entry->dirTimes = times;
+    entry->dirCount = dirCount;
+    unsigned int b = intern_hash(entry->name) % PATH_CACHE_BUCKETS;
+    entry->next = pathCache[b];
+    pathCache[b] = entry;
+    return copy;
+}
+
+// Returns the executable for name, or NULL to leave the lookup to execvpe
+const char* command_path(const char* name) {
+    if (strchr(name, '/') != NULL || *name == '\0')
+        return NULL;
+    const char* atom = intern_find(name);
+    if (atom != NULL) {
+        unsigned int b = intern_hash(atom) % PATH_CACHE_BUCKETS;
+        for (PathEntry** link = &pathCache[b]; *link != NULL; link = &(*link)->next) {
+            PathEntry* entry = *link;
+            if (entry->name != atom)
+                continue;
+            if (!path_entry_stale(entry)) {
+                pathHits++;
+                return entry->path;
+            }
+            *link = entry->next;
+            free_path_entry(entry);
+            break;
+        }
+    }
+    pathMisses++;
+    const char* path = getenv("PATH");
+    if (path == NULL)
+        return NULL;   // execvpe's default search path
+    int dirs = 1;
+    for (const char* c = path; *c != '\0'; c++)
+        dirs += *c == ':';
+    struct timespec stackTimes[32];
+    struct timespec* dirTimes = dirs <= 32 ? stackTimes : (struct timespec*)malloc(dirs * sizeof(struct timespec));
+    if (dirTimes == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    const char* found = NULL;
+    char candidate[PATH_MAX];
+    size_t nameLen = strlen(name);
+    int searched = 0;
+    while (*path != '\0' && found == NULL) {
+        const char* end = strchrnul(path, ':');
+        size_t dirLen = end - path;
+        path_dir_name(path, dirLen, candidate, sizeof(candidate));
+        dirTimes[searched++] = path_dir_time(candidate);
+        dirLen = strlen(candidate);
+        if (dirLen + nameLen + 2 <= sizeof(candidate)) {
+            candidate[dirLen] = '/';
+            memcpy(candidate + dirLen + 1, name, nameLen + 1);
+            struct stat st;
+            if (access(candidate, X_OK) == 0 && stat(candidate, &st) == 0 && S_ISREG(st.st_mode))
+                found = cache_command_path(name, candidate, dirTimes, searched);
+        }
+        path = *end == ':' ? end + 1 : end;
+    }
+    if (dirTimes != stackTimes)
+        free(dirTimes);
+    return found;
+}
+
+#define ALIAS_KEY_MAX 49
 
 // Define a node structure for the linked list
 typedef struct Node {
-    char key[50];
+    const char* key;     // interned, at most ALIAS_KEY_MAX bytes
     char* value;
-    struct Node* next;
+    struct Node* next;   // list order (newest first)
+    struct Node* prev;
+    struct Node* hnext;  // next node in the same hash bucket
 } Node;
 
 // Define a dictionary structure
 typedef struct {
     Node* head;  // Pointer to the head of the linked list
     int count;   // Number of key-value pairs in the dictionary
+    Node** buckets;    // Hash index over the keys
+    int bucketCount;
 } Dictionary;
 
+// Shared alias segment. With $MINISHELL_SHM_ALIASES set to a name like
+// /minishell-aliases, every shell on the host keeps its aliases in one
+// shm_open segment instead of a private table: an open-addressing hash of
+// slots plus an arena holding each key and value. Writers serialize on
+// flock and publish through a seqlock (seq is odd while a write is in
+// progress); readers copy what they need and retry if seq moved, so an
+// alias or unalias in one shell is seen by the others on their next lookup.
+#define ALIAS_SHM_MAGIC 0x4d53484du   // "MHSM"
+#define ALIAS_SHM_VERSION 1
+#define ALIAS_SHM_SLOTS (1u << 18)
+#define ALIAS_SHM_ARENA (64u << 20)
+
+enum { SHM_EMPTY, SHM_LIVE, SHM_DELETED };
+
+typedef struct AliasShmSlot {
+    uint32_t hash;
+    uint16_t keyLen;
+    uint16_t state;
+    uint32_t offset;     // key bytes, then value bytes, in the arena
+    uint32_t valueLen;
+} AliasShmSlot;
+
+typedef struct AliasShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;        // seqlock sequence
+    uint32_t count;      // live aliases
+    uint32_t used;       // live plus deleted slots
+    uint32_t slotCount;
+    uint64_t generation; // bumped by every change
+    uint64_t arenaSize;
+    uint64_t arenaUsed;
+    uint64_t arenaDead;  // bytes of replaced or removed entries
+} AliasShmHeader;
+
+typedef struct AliasShm {
+    int fd;
+    pid_t fdOwner;           // flock is per open file, so a forked child reopens the segment
+    char name[256];
+    size_t mapSize;
+    AliasShmHeader* header;
+    AliasShmSlot* slots;
+    char* arena;
+    unsigned long retries;   // reads repeated because a writer got in between
+} AliasShm;
+
+AliasShm* aliasShm = NULL;
+
+#define SHM_READER_SPINS 1000   // odd-seq rounds before a reader checks for a dead writer
+
+// The segment's fd for flock. A forked session or subshell shares its
+// parent's open file, and with it the parent's lock, so it opens its own
+int shm_lock_fd(AliasShm* shm) {
+    if (shm->fdOwner != getpid()) {
+        int fd = shm_open(shm->name, O_RDWR | O_CLOEXEC, 0600);
+        if (fd != -1) {
+            close(shm->fd);
+            shm->fd = fd;
+        }
+        shm->fdOwner = getpid();
+    }
+    return shm->fd;
+}
+
+void shm_compact(AliasShm* shm);
+
+// Called by a reader that keeps finding seq odd. A live writer holds the
+// lock; if the lock is free and seq is still odd, the writer died between
+// shm_write_begin and shm_write_end, so the reader rebuilds what is intact
+// and publishes it, as the next writer would
+void shm_repair(AliasShm* shm) {
+    int fd = shm_lock_fd(shm);
+    if (flock(fd, LOCK_EX | LOCK_NB) == -1)
+        return;
+    uint32_t seq = __atomic_load_n(&shm->header->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+        shm_compact(shm);
+        shm->header->generation++;
+        __atomic_store_n(&shm->header->seq, seq + 1, __ATOMIC_RELEASE);
+    }
+    flock(fd, LOCK_UN);
+}
+
+uint32_t shm_seq_begin(AliasShm* shm) {
+    uint32_t seq;
+    unsigned int spins = 0;
+    while ((seq = __atomic_load_n(&shm->header->seq, __ATOMIC_ACQUIRE)) & 1) {
+        if (++spins % SHM_READER_SPINS == 0)
+            shm_repair(shm);
+        sched_yield();
+    }
+    return seq;
+}
+
+int shm_seq_retry(AliasShm* shm, uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&shm->header->seq, __ATOMIC_RELAXED) == seq)
+        return 0;
+    shm->retries++;
+    return 1;
+}
+
+// Slot index for key, or -1; the caller is inside a read section or holds the lock.
+// Offsets are checked because a reader may see a half-written table
+long shm_probe(const AliasShm* shm, const char* key, size_t keyLen, uint32_t hash, int forInsert) {
+    uint32_t mask = shm->header->slotCount - 1;
+    long firstFree = -1;
+    for (uint32_t i = 0, idx = hash & mask; i <= mask; i++, idx = (idx + 1) & mask) {
+        const AliasShmSlot* slot = &shm->slots[idx];
+        if (slot->state == SHM_EMPTY)
+            return forInsert ? (firstFree >= 0 ? firstFree : (long)idx) : -1;
+        if (slot->state == SHM_DELETED) {
+            if (firstFree < 0)
+                firstFree = idx;
+            continue;
+        }
+        if (slot->hash == hash && slot->keyLen == keyLen &&
+            (uint64_t)slot->offset + keyLen <= shm->header->arenaSize &&
+            memcmp(shm->arena + slot->offset, key, keyLen) == 0)
+            return idx;
+    }
+    return forInsert ? firstFree : -1;
+}
+
+// Copies the value of key into *out (grown as needed); returns 0 if absent
+int shm_lookup(AliasShm* shm, const char* key, char** out, size_t* outSize) {
+    size_t keyLen = strnlen(key, ALIAS_KEY_MAX);
+    uint32_t hash = intern_hash_text(key, keyLen);
+    while (1) {
+        uint32_t seq = shm_seq_begin(shm);
+        long idx = shm_probe(shm, key, keyLen, hash, 0);
+        int found = 0;
+        if (idx >= 0) {
+            AliasShmSlot slot = shm->slots[idx];
+            uint64_t end = (uint64_t)slot.offset + slot.keyLen + slot.valueLen;
+            if (end <= shm->header->arenaSize) {
+                if (*outSize < (size_t)slot.valueLen + 1) {
+                    *outSize = slot.valueLen + 1;
+                    *out = (char*)realloc(*out, *outSize);
+                    if (*out == NULL) {
+                        perror("malloc");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                memcpy(*out, shm->arena + slot.offset + slot.keyLen, slot.valueLen);
+                (*out)[slot.valueLen] = '\0';
+                found = 1;
+            }
+        }
+        if (!shm_seq_retry(shm, seq))
+            return found;
+    }
+}
+
+// Rewrites the table without deleted slots and dead arena bytes; called under the lock
+void shm_compact(AliasShm* shm) {
+    AliasShmHeader* header = shm->header;
+    size_t slotBytes = (size_t)header->slotCount * sizeof(AliasShmSlot);
+    AliasShmSlot* slots = (AliasShmSlot*)calloc(header->slotCount, sizeof(AliasShmSlot));
+    char* arena = (char*)malloc(header->arenaUsed ? header->arenaUsed : 1);
+    if (slots == NULL || arena == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t mask = header->slotCount - 1, count = 0;
+    uint64_t used = 0;
+    for (uint32_t i = 0; i < header->slotCount; i++) {
+        AliasShmSlot slot = shm->slots[i];
+        uint64_t len = (uint64_t)slot.keyLen + slot.valueLen;
+        if (slot.state != SHM_LIVE || slot.offset + len > header->arenaUsed)
+            continue;
+        memcpy(arena + used, shm->arena + slot.offset, len);
+        slot.offset = (uint32_t)used;
+        used += len;
+        uint32_t idx = slot.hash & mask;
+        while (slots[idx].state != SHM_EMPTY)
+            idx = (idx + 1) & mask;
+        slots[idx] = slot;
+        count++;
+    }
+    memcpy(shm->slots, slots, slotBytes);
+    memcpy(shm->arena, arena, used);
+    header->count = header->used = count;
+    header->arenaUsed = used;
+    header->arenaDead = 0;
+    free(slots);
+    free(arena);
+}
+
+void shm_write_begin(AliasShm* shm) {
+    while (flock(shm_lock_fd(shm), LOCK_EX) == -1 && errno == EINTR)
+        ;
+    uint32_t seq = shm->header->seq;
+    if ((seq & 1) == 0) {
+        __atomic_store_n(&shm->header->seq, seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    } else {
+        // An odd seq under the lock means a writer died mid-update: rebuild what is intact
+        shm_compact(shm);
+    }
+}
+
+void shm_write_end(AliasShm* shm) {
+    shm->header->generation++;
+    __atomic_store_n(&shm->header->seq, shm->header->seq + 1, __ATOMIC_RELEASE);
+    flock(shm->fd, LOCK_UN);
+}
+
+// Adds or replaces an alias under the write lock; returns 0 when the segment is full
+int shm_put(AliasShm* shm, const char* key, const char* value, size_t valueLen) {
+    size_t keyLen = strnlen(key, ALIAS_KEY_MAX);
+    uint32_t hash = intern_hash_text(key, keyLen);
+    AliasShmHeader* header = shm->header;
+    if (header->used + 1 > header->slotCount / 4 * 3 || header->arenaUsed + keyLen + valueLen > header->arenaSize)
+        shm_compact(shm);
+    int ok = 0;
+    long idx = shm_probe(shm, key, keyLen, hash, 1);
+    if (idx >= 0 && header->used + 1 <= header->slotCount / 4 * 3 &&
+        header->arenaUsed + keyLen + valueLen <= header->arenaSize) {
+        AliasShmSlot* slot = &shm->slots[idx];
+        uint64_t offset = header->arenaUsed;
+        memcpy(shm->arena + offset, key, keyLen);
+        memcpy(shm->arena + offset + keyLen, value, valueLen);
+        header->arenaUsed += keyLen + valueLen;
+        if (slot->state == SHM_LIVE) {
+            header->arenaDead += slot->keyLen + slot->valueLen;
+        } else {
+            if (slot->state == SHM_EMPTY)
+                header->used++;
+            header->count++;
+        }
+        slot->hash = hash;
+        slot->keyLen = (uint16_t)keyLen;
+        slot->offset = (uint32_t)offset;
+        slot->valueLen = (uint32_t)valueLen;
+        slot->state = SHM_LIVE;
+        ok = 1;
+    }
+    return ok;
+}
+
+int shm_store(AliasShm* shm, const char* key, const char* value, size_t valueLen) {
+    shm_write_begin(shm);
+    int ok = shm_put(shm, key, value, valueLen);
+    shm_write_end(shm);
+    return ok;
+}
+
+// Removes an alias; returns 0 if it was not there
+int shm_remove(AliasShm* shm, const char* key) {
+    size_t keyLen = strnlen(key, ALIAS_KEY_MAX);
+    shm_write_begin(shm);
+    long idx = shm_probe(shm, key, keyLen, intern_hash_text(key, keyLen), 0);
+    if (idx >= 0) {
+        AliasShmSlot* slot = &shm->slots[idx];
+        slot->state = SHM_DELETED;
+        shm->header->count--;
+        shm->header->arenaDead += slot->keyLen + slot->valueLen;
+    }
+    shm_write_end(shm);
+    return idx >= 0;
+}
+
+// Calls fn for every alias in a consistent copy of the table
+void shm_foreach(AliasShm* shm, void (*fn)(const char* key, size_t keyLen, const char* value, size_t valueLen, void* ctx),
+                 void* ctx) {
+    // Copy the live entries out under the seqlock, then call fn without it
+    char* copy = NULL;
+    size_t copySize = 0, copyUsed;
+    while (1) {
+        uint32_t seq = shm_seq_begin(shm);
+        copyUsed = 0;
+        for (uint32_t i = 0; i < shm->header->slotCount; i++) {
+            AliasShmSlot slot = shm->slots[i];
+            uint64_t len = (uint64_t)slot.keyLen + slot.valueLen;
+            if (slot.state != SHM_LIVE || slot.offset + len > shm->header->arenaSize)
+                continue;
+            size_t need = copyUsed + sizeof(uint32_t) * 2 + len;
+            if (need > copySize) {
+                copySize = need * 2;
+                copy = (char*)realloc(copy, copySize);
+                if (copy == NULL) {
+                    perror("malloc");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            uint32_t lens[2] = { slot.keyLen, slot.valueLen };
+            memcpy(copy + copyUsed, lens, sizeof(lens));
+            memcpy(copy + copyUsed + sizeof(lens), shm->arena + slot.offset, len);
+            copyUsed += sizeof(lens) + len;
+        }
+        if (!shm_seq_retry(shm, seq))
+            break;
+    }
+    for (size_t pos = 0; pos < copyUsed;) {
+        uint32_t lens[2];
+        memcpy(lens, copy + pos, sizeof(lens));
+        pos += sizeof(lens);
+        fn(copy + pos, lens[0], copy + pos + lens[0], lens[1], ctx);
+        pos += lens[0] + lens[1];
+    }
+    free(copy);
+}
+
+void load_aliases(Dictionary* dict);
+
+// Opens the segment, creating it if needed. The shell that creates it seeds it
+// with its own aliases (snapshot or ~/.minishellrc) while holding the lock
+AliasShm* shm_attach(const char* name, Dictionary* seed) {
+    size_t mapSize = sizeof(AliasShmHeader) + (size_t)ALIAS_SHM_SLOTS * sizeof(AliasShmSlot) + ALIAS_SHM_ARENA;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        perror("shm_open");
+        return NULL;
+    }
+    // The first shell to take the lock sizes and formats the segment
+    while (flock(fd, LOCK_EX) == -1 && errno == EINTR)
+        ;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || ((size_t)st.st_size < mapSize && ftruncate(fd, mapSize) == -1)) {
+        perror("shm alias segment");
+        close(fd);
+        return NULL;
+    }
+    if ((size_t)st.st_size > mapSize)
+        mapSize = st.st_size;
+    char* map = (char*)mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return NULL;
+    }
+    AliasShm* shm = (AliasShm*)calloc(1, sizeof(AliasShm));
+    if (shm == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    shm->fd = fd;
+    shm->fdOwner = getpid();
+    snprintf(shm->name, sizeof(shm->name), "%s", name);
+    shm->mapSize = mapSize;
+    shm->header = (AliasShmHeader*)map;
+    int created = shm->header->magic != ALIAS_SHM_MAGIC;
+    if (created) {
+        shm->header->version = ALIAS_SHM_VERSION;
+        shm->header->slotCount = ALIAS_SHM_SLOTS;
+        shm->header->arenaSize = ALIAS_SHM_ARENA;
+    }
+    if (shm->header->version != ALIAS_SHM_VERSION ||
+        sizeof(AliasShmHeader) + (size_t)shm->header->slotCount * sizeof(AliasShmSlot) + shm->header->arenaSize > mapSize) {
+        fprintf(stderr, "ERR\n");
+        flock(fd, LOCK_UN);
+        munmap(map, mapSize);
+        close(fd);
+        free(shm);
+        return NULL;
+    }
+    shm->slots = (AliasShmSlot*)(map + sizeof(AliasShmHeader));
+    shm->arena = (char*)(shm->slots + shm->header->slotCount);
+    if (created) {
+        // A creator that died while seeding leaves a partial table behind
+        if (shm->header->used != 0)
+            memset(shm->slots, 0, (size_t)shm->header->slotCount * sizeof(AliasShmSlot));
+        memset(shm->header, 0, offsetof(AliasShmHeader, slotCount));
+        shm->header->arenaUsed = shm->header->arenaDead = 0;
+        load_aliases(seed);
+        for (Node* current = seed->head; current != NULL; current = current->next)
+            shm_put(shm, current->key, current->value, strlen(current->value));
+        shm->header->version = ALIAS_SHM_VERSION;
+        shm->header->magic = ALIAS_SHM_MAGIC;
+    }
+    flock(fd, LOCK_UN);
+    return shm;
+}
+
+// Fixed-size object pools. Objects are carved from slabs (4 KB first, doubling
+// up to 64 KB) and recycled through a free list, so alias and job churn reuses
+// the same memory instead of fragmenting the heap. pool_free is a single push,
+// which keeps it usable from the SIGCHLD handler as long as the main path
+// allocates from that pool with SIGCHLD blocked.
+#define POOL_SLAB_MIN (4 * 1024)
+#define POOL_SLAB_MAX (64 * 1024)
+
+typedef struct PoolFree {
+    struct PoolFree* next;
+} PoolFree;
+
+typedef struct Pool {
+    const char* name;
+    size_t size;             // object size, a multiple of 16
+    PoolFree* freeList;
+    char* bump;              // unused tail of the newest slab
+    size_t bumpLeft;
+    long slabs;
+    size_t slabBytes;
+    long live;
+    long peak;
+} Pool;
+
+void* pool_alloc(Pool* pool) {
+    void* object;
+    if (pool->freeList != NULL) {
+        object = pool->freeList;
+        pool->freeList = pool->freeList->next;
+    } else {
+        if (pool->bumpLeft < pool->size) {
+            size_t slab = pool->slabs < 4 ? (size_t)POOL_SLAB_MIN << pool->slabs : POOL_SLAB_MAX;
+            pool->bump = (char*)malloc(slab);
+            if (pool->bump == NULL) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+            pool->bumpLeft = slab;
+            pool->slabs++;
+            pool->slabBytes += slab;
+        }
+        object = pool->bump;
+        pool->bump += pool->size;
+        pool->bumpLeft -= pool->size;
+    }
+    if (++pool->live > pool->peak)
+        pool->peak = pool->live;
+    return object;
+}
+
+void pool_free(Pool* pool, void* object) {
+    PoolFree* entry = (PoolFree*)object;
+    entry->next = pool->freeList;
+    pool->freeList = entry;
+    pool->live--;
+}
+
+// Strings up to 1 KB go to power-of-two size classes; longer ones to malloc
+#define STRING_CLASSES 7     // 16 .. 1024 bytes
+
+typedef struct StringPool {
+    Pool classes[STRING_CLASSES];
+    long large;              // live strings too long for a class
+    size_t largeBytes;
+} StringPool;
+
+#define STRING_POOL(label) { { { label, 16, NULL, NULL, 0, 0, 0, 0, 0 }, { label, 32, NULL, NULL, 0, 0, 0, 0, 0 }, \
+    { label, 64, NULL, NULL, 0, 0, 0, 0, 0 }, { label, 128, NULL, NULL, 0, 0, 0, 0, 0 }, \
+    { label, 256, NULL, NULL, 0, 0, 0, 0, 0 }, { label, 512, NULL, NULL, 0, 0, 0, 0, 0 }, \
+    { label, 1024, NULL, NULL, 0, 0, 0, 0, 0 } }, 0, 0 }
+
+Pool nodePool = { "alias nodes", (sizeof(Node) + 15) & ~(size_t)15, NULL, NULL, 0, 0, 0, 0, 0 };
+StringPool aliasStrings = STRING_POOL("alias values");
+
+int string_class(size_t bytes) {
+    int index = 0;
+    size_t size = 16;
+    while (size < bytes) {
+        size *= 2;
+        index++;
+    }
+    return index;
+}
+
+// Copies len bytes of text plus a terminating NUL into pooled storage
+char* pool_strndup(StringPool* strings, const char* text, size_t len) {
+    int index = string_class(len + 1);
+    char* copy;
+    if (index < STRING_CLASSES) {
+        copy = (char*)pool_alloc(&strings->classes[index]);
+    } else {
+        copy = (char*)malloc(len + 1);
+        if (copy == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        strings->large++;
+        strings->largeBytes += len + 1;
+    }
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+char* pool_strdup(StringPool* strings, const char* text) {
+    return pool_strndup(strings, text, strlen(text));
+}
+
+void pool_strfree(StringPool* strings, char* text) {
+    size_t bytes = strlen(text) + 1;
+    int index = string_class(bytes);
+    if (index < STRING_CLASSES) {
+        pool_free(&strings->classes[index], text);
+    } else {
+        strings->large--;
+        strings->largeBytes -= bytes;
+        free(text);
+    }
+}
+
 int isExist(const Dictionary* dict, const char* key);
 void removeNode(Dictionary* dict, const char* key);
 
+// Set when an alias is added or removed, so the snapshot is rewritten on exit
+int aliasDirty = 0;
+// Bumped on every alias change, so caches derived from the table know they are stale
+unsigned long aliasGeneration = 0;
+
+// FNV-1a hash of a key
+unsigned int hashKey(const char* key) {
+    unsigned int hash = 2166136261u;
+    while (*key) {
+        hash ^= (unsigned char)*key++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
 // Function to initialize a dictionary
 void initDictionary(Dictionary* dict) {
     dict->head = NULL;
     dict->count = 0;
+    dict->bucketCount = 64;
+    dict->buckets = (Node**)calloc(dict->bucketCount, sizeof(Node*));
+    if (dict->buckets == NULL) {
+        fprintf(stderr, "Failed to allocate memory for buckets.\n");
+        exit(EXIT_FAILURE);
+    }
 }
 
-// Function to add a key-value pair to the dictionary to the beginning
-void addNode(Dictionary* dict, const char* key, const char* value) {
-    // Check if the alias already exists
-    Node* current = dict->head;
-    while (current != NULL) {
-        if (strcmp(current->key, key) == 0) {
-            // Free the memory allocated for the previous value
-            free(current->value);
-            // Allocate memory for the new value
-            current->value = (char *)malloc(strlen(value) + 1);
-            if (current->value == NULL) {
-                fprintf(stderr, "Failed to allocate memory for value.\n");
-                exit(EXIT_FAILURE);
-            }
-            // Copy the new value
-            strcpy(current->value, value);
-            return;
-        }
-        current = current->next;
+// Doubles the bucket array once the load factor passes 2
+void growBuckets(Dictionary* dict) {
+    int newCount = dict->bucketCount * 2;
+    Node** buckets = (Node**)calloc(newCount, sizeof(Node*));
+    if (buckets == NULL) {
+        fprintf(stderr, "Failed to allocate memory for buckets.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (Node* current = dict->head; current != NULL; current = current->next) {
+        unsigned int b = intern_hash(current->key) % newCount;
+        current->hnext = buckets[b];
+        buckets[b] = current;
     }
+    free(dict->buckets);
+    dict->buckets = buckets;
+    dict->bucketCount = newCount;
+}
 
-    // Create a new node if NOT exist
-    Node* newNode = (Node*)malloc(sizeof(Node));
-    if (newNode == NULL) {
-        fprintf(stderr, "Failed to allocate memory for new node.\n");
-        exit(EXIT_FAILURE);
+// Returns the node holding key, or NULL. A key that was never interned
+// cannot be an alias, so most lookups end without touching the buckets
+Node* findNode(const Dictionary* dict, const char* key) {
+    const char* atom = intern_find(key);
+    if (atom == NULL)
+        return NULL;
+    Node* current = dict->buckets[intern_hash(atom) % dict->bucketCount];
+    while (current != NULL) {
+        if (current->key == atom)
+            return current;
+        current = current->hnext;
     }
+    return NULL;
+}
 
+// Links a new node into the hash index and into the list, at the head or after tail
+Node* linkNewNode(Dictionary* dict, const char* key, const char* value, size_t valueLen, Node* tail) {
+    if (dict->count >= dict->bucketCount * 2)
+        growBuckets(dict);
+
+    Node* newNode = (Node*)pool_alloc(&nodePool);
 
     // Initialize the new node
-    strncpy(newNode->key, key, sizeof(newNode->key) - 1);
-    newNode->key[sizeof(newNode->key) - 1] = '\0';
+    newNode->key = intern_n(key, strnlen(key, ALIAS_KEY_MAX));
 
-    // Allocate memory for the value and copy it
-    newNode->value = (char *)malloc(strlen(value) + 1);
-    if (newNode->value == NULL) {
-        fprintf(stderr, "Failed to allocate memory for value.\n");
-        free(newNode);
-        exit(EXIT_FAILURE);
-    }
-    strcpy(newNode->value, value);
+    // Copy the value into pooled storage
+    newNode->value = pool_strndup(&aliasStrings, value, valueLen);
 
-    newNode->next = dict->head;
+    if (tail == NULL) {
+        // Insert the new node at the beginning of the list
+        newNode->prev = NULL;
+        newNode->next = dict->head;
+        if (dict->head != NULL)
+            dict->head->prev = newNode;
+        dict->head = newNode;
+    } else {
+        newNode->prev = tail;
+        newNode->next = NULL;
+        tail->next = newNode;
+    }
 
-    // Insert the new node at the beginning of the list
-    dict->head = newNode;
+    unsigned int b = intern_hash(newNode->key) % dict->bucketCount;
+    newNode->hnext = dict->buckets[b];
+    dict->buckets[b] = newNode;
     dict->count++;
+    return newNode;
+}
+
+// Function to add a key-value pair to the dictionary to the beginning
+void addNode(Dictionary* dict, const char* key, const char* value) {
+    aliasDirty = 1;
+    aliasGeneration++;
+    if (aliasShm != NULL) {
+        if (!shm_store(aliasShm, key, value, strlen(value)))
+            fprintf(stderr, "ERR\n");  // segment full
+        return;
+    }
+    // Check if the alias already exists
+    Node* current = findNode(dict, key);
+    if (current != NULL) {
+        // Replace the previous value
+        pool_strfree(&aliasStrings, current->value);
+        current->value = pool_strdup(&aliasStrings, value);
+        return;
+    }
+
+    // Create a new node if NOT exist
+    linkNewNode(dict, key, value, strlen(value), NULL);
 }
 
 // Function to remove a key-value pair from the dictionary
 void removeNode(Dictionary* dict, const char* key) {
-    Node* current = dict->head;
-    Node* prev = NULL;
-
-    while (current != NULL) {
-        if (strcmp(current->key, key) == 0) {
-            if (prev == NULL) {
+    if (aliasShm != NULL) {
+        if (shm_remove(aliasShm, key)) {
+            aliasDirty = 1;
+            aliasGeneration++;
+        } else {
+            printf("Key '%s' not found.\n", key);
+        }
+        return;
+    }
+    const char* atom = intern_find(key);
+    Node** link = atom != NULL ? &dict->buckets[intern_hash(atom) % dict->bucketCount] : NULL;
+    while (link != NULL && *link != NULL) {
+        Node* current = *link;
+        if (current->key == atom) {
+            *link = current->hnext;
+            if (current->prev == NULL) {
                 // Node to be removed is the head
                 dict->head = current->next;
             } else {
                 // Node to be removed is in the middle or end
-                prev->next = current->next;
+                current->prev->next = current->next;
             }
-            free(current->value);
-            free(current);
+            if (current->next != NULL)
+                current->next->prev = current->prev;
+            intern_release(current->key);
+            pool_strfree(&aliasStrings, current->value);
+            pool_free(&nodePool, current);
             dict->count--;
+            aliasDirty = 1;
+            aliasGeneration++;
             return;
         }
-        prev = current;
-        current = current->next;
+        link = &current->hnext;
     }
 
     printf("Key '%s' not found.\n", key);
@@ -106,26 +1007,23 @@ void removeNode(Dictionary* dict, const char* key) {
 
 // Function to search for a value by key in the dictionary
 char* searchNode(const Dictionary* dict, const char* key) {
-    Node* current = dict->head;
-    while (current != NULL) {
-        if (strcmp(current->key, key)==0) {
-            return current->value;
-        }
-        current = current->next;
+    if (aliasShm != NULL) {
+        // Two buffers, so a value stays valid across the next lookup
+        static char* values[2];
+        static size_t sizes[2];
+        static int turn;
+        turn ^= 1;
+        return shm_lookup(aliasShm, key, &values[turn], &sizes[turn]) ? values[turn] : NULL;
     }
-    return NULL;  // Key not found
+    Node* current = findNode(dict, key);
+    return current != NULL ? current->value : NULL;  // NULL - Key not found
 }
 
 // Function to check if a key exists in the dictionary
 int isExist(const Dictionary* dict, const char* key) {
-    Node* current = dict->head;
-    while (current != NULL) {
-        if (strcmp(current->key, key) == 0) {
-            return 1;  // Key exists
-        }
-        current = current->next;
-    }
-    return 0;  // Key does not exist
+    if (aliasShm != NULL)
+        return searchNode(dict, key) != NULL;
+    return findNode(dict, key) != NULL;
 }
 
 // Function to free the dictionary
@@ -134,48 +1032,504 @@ void freeDictionary(Dictionary* dict) {
     Node* next;
     while (current != NULL) {
         next = current->next;
-        free(current->value);
-        free(current);
+        intern_release(current->key);
+        pool_strfree(&aliasStrings, current->value);
+        pool_free(&nodePool, current);
         current = next;
     }
     dict->head = NULL;
     dict->count = 0;
+    free(dict->buckets);
+    dict->buckets = NULL;
+    dict->bucketCount = 0;
 }
 
-// Function to print the dictionary
-void printDictionary(const Dictionary* dict) {
-    Node* current = dict->head;
-    while (current != NULL) {
-        printf("%s='%s'\n", current->key, current->value);
+void print_alias(const char* key, size_t keyLen, const char* value, size_t valueLen, void* ctx) {
+    (void)ctx;
+    printf("%.*s='%.*s'\n", (int)keyLen, key, (int)valueLen, value);
+}
+
+void export_alias(const char* key, size_t keyLen, const char* value, size_t valueLen, void* ctx) {
+    char name[ALIAS_KEY_MAX + 1];
+    memcpy(name, key, keyLen);
+    name[keyLen] = '\0';
+    linkNewNode((Dictionary*)ctx, name, value, valueLen, NULL);
+}
+
+// Number of aliases, in the shared segment when there is one
+int alias_count(const Dictionary* dict) {
+    return aliasShm != NULL ? (int)__atomic_load_n(&aliasShm->header->count, __ATOMIC_RELAXED) : dict->count;
+}
+
+// Another shell's change to the shared segment makes derived caches stale here too
+void alias_shm_sync() {
+    static uint64_t seen;
+    if (aliasShm == NULL)
+        return;
+    uint64_t generation = __atomic_load_n(&aliasShm->header->generation, __ATOMIC_RELAXED);
+    if (generation != seen) {
+        seen = generation;
+        aliasGeneration++;
+    }
+}
+
+// Function to print the dictionary
+void printDictionary(const Dictionary* dict) {
+    if (aliasShm != NULL) {
+        shm_foreach(aliasShm, print_alias, NULL);
+        return;
+    }
+    Node* current = dict->head;
+    while (current != NULL) {
+        printf("%s='%s'\n", current->key, current->value);
         current = current->next;
     }
 }
 
+// Alias snapshot file: a header followed by packed records
+// (uint8 key length, uint32 value length, key bytes, value bytes)
+#define ALIAS_SNAPSHOT_MAGIC "MSAL"
+#define ALIAS_SNAPSHOT_VERSION 1
+
+typedef struct AliasSnapshotHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t checksum;  // FNV-1a over the record bytes
+    uint64_t size;      // number of record bytes after the header
+} AliasSnapshotHeader;
+
+int checkForAlias(char* input, Dictionary* dict);
+void free_split_string(char **str_array);
+
+// FNV-1a over a byte range
+uint32_t hashBytes(const unsigned char* data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Snapshot path: $MINISHELL_ALIASES, else ~/.minishell_aliases; returns 0 when persistence is off
+int alias_snapshot_path(char* out, size_t size) {
+    const char* env = getenv("MINISHELL_ALIASES");
+    if (env != NULL) {
+        if (env[0] == '\0')
+            return 0;
+        snprintf(out, size, "%s", env);
+        return 1;
+    }
+    const char* home = getenv("HOME");
+    if (home == NULL)
+        return 0;
+    snprintf(out, size, "%s/.minishell_aliases", home);
+    return 1;
+}
+
+// Bytes needed for the packed alias records of dict
+size_t alias_records_size(const Dictionary* dict) {
+    size_t size = 0;
+    for (Node* current = dict->head; current != NULL; current = current->next)
+        size += 1 + sizeof(uint32_t) + strlen(current->key) + strlen(current->value);
+    return size;
+}
+
+// Packs every alias at ptr; returns the end of the records
+unsigned char* pack_alias_records(const Dictionary* dict, unsigned char* ptr) {
+    for (Node* current = dict->head; current != NULL; current = current->next) {
+        uint8_t keyLen = (uint8_t)strlen(current->key);
+        uint32_t valueLen = (uint32_t)strlen(current->value);
+        *ptr++ = keyLen;
+        memcpy(ptr, &valueLen, sizeof(valueLen));
+        ptr += sizeof(valueLen);
+        memcpy(ptr, current->key, keyLen);
+        ptr += keyLen;
+        memcpy(ptr, current->value, valueLen);
+        ptr += valueLen;
+    }
+    return ptr;
+}
+
+// Replaces path with data through a temporary file and rename
+int replace_file(const char* path, const unsigned char* data, size_t total, const char* what) {
+    char tmpPath[1100];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp.%d", path, getpid());
+    int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror(what);
+        return 0;
+    }
+    size_t done = 0;
+    while (done < total) {
+        ssize_t n = write(fd, data + done, total - done);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            perror(what);
+            close(fd);
+            unlink(tmpPath);
+            return 0;
+        }
+        done += (size_t)n;
+    }
+    close(fd);
+    if (rename(tmpPath, path) == -1) {
+        perror(what);
+        unlink(tmpPath);
+        return 0;
+    }
+    return 1;
+}
+
+// Writes every alias to the snapshot file (through a temporary file and rename)
+int write_alias_snapshot(const Dictionary* dict) {
+    char path[1024];
+    if (!alias_snapshot_path(path, sizeof(path)))
+        return 0;
+
+    size_t size = alias_records_size(dict);
+    unsigned char* buffer = (unsigned char*)malloc(sizeof(AliasSnapshotHeader) + size);
+    if (buffer == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    pack_alias_records(dict, buffer + sizeof(AliasSnapshotHeader));
+
+    AliasSnapshotHeader header;
+    memcpy(header.magic, ALIAS_SNAPSHOT_MAGIC, 4);
+    header.version = ALIAS_SNAPSHOT_VERSION;
+    header.count = (uint32_t)dict->count;
+    header.checksum = hashBytes(buffer + sizeof(header), size);
+    header.size = size;
+    memcpy(buffer, &header, sizeof(header));
+
+    int saved = replace_file(path, buffer, sizeof(header) + size, "alias snapshot");
+    free(buffer);
+    return saved;
+}
+
+int save_alias_snapshot(const Dictionary* dict) {
+    if (aliasShm == NULL)
+        return write_alias_snapshot(dict);
+    Dictionary exported;
+    initDictionary(&exported);
+    shm_foreach(aliasShm, export_alias, &exported);
+    int saved = write_alias_snapshot(&exported);
+    freeDictionary(&exported);
+    return saved;
+}
+
+// Links count packed records into an empty dict in one pass; returns the end of what was read
+const unsigned char* link_alias_records(Dictionary* dict, const unsigned char* ptr, const unsigned char* end,
+                                        uint32_t count) {
+    // Size the hash index up front so the load never rehashes
+    while (dict->bucketCount * 2 < (int)count)
+        dict->bucketCount *= 2;
+    free(dict->buckets);
+    dict->buckets = (Node**)calloc(dict->bucketCount, sizeof(Node*));
+    if (dict->buckets == NULL) {
+        fprintf(stderr, "Failed to allocate memory for buckets.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Keys are unique in a snapshot, so records are appended without a lookup
+    Node* tail = NULL;
+    char key[ALIAS_KEY_MAX + 1];
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t valueLen;
+        if (end - ptr < 1 + (long)sizeof(valueLen))
+            break;
+        uint8_t keyLen = *ptr++;
+        memcpy(&valueLen, ptr, sizeof(valueLen));
+        ptr += sizeof(valueLen);
+        if (keyLen >= sizeof(key) || (size_t)(end - ptr) < (size_t)keyLen + valueLen)
+            break;
+        memcpy(key, ptr, keyLen);
+        key[keyLen] = '\0';
+        ptr += keyLen;
+        tail = linkNewNode(dict, key, (const char*)ptr, valueLen, tail);
+        ptr += valueLen;
+    }
+    return ptr;
+}
+
+// Maps the snapshot and builds the alias table in one pass; returns 0 if it is missing or invalid
+int load_alias_snapshot(Dictionary* dict, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return 0;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(AliasSnapshotHeader)) {
+        close(fd);
+        return 0;
+    }
+    unsigned char* map = (unsigned char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+
+    AliasSnapshotHeader header;
+    memcpy(&header, map, sizeof(header));
+    const unsigned char* ptr = map + sizeof(header);
+    const unsigned char* end = ptr + header.size;
+    if (memcmp(header.magic, ALIAS_SNAPSHOT_MAGIC, 4) != 0 || header.version != ALIAS_SNAPSHOT_VERSION ||
+        header.size != (uint64_t)st.st_size - sizeof(header) || hashBytes(ptr, header.size) != header.checksum) {
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    link_alias_records(dict, ptr, end, header.count);
+    munmap(map, st.st_size);
+    return 1;
+}
+
+// Runs the alias lines of ~/.minishellrc, the text fallback for a missing or stale snapshot
+void load_alias_rc(Dictionary* dict) {
+    const char* home = getenv("HOME");
+    char path[1024];
+    char line[1024];
+    if (home == NULL)
+        return;
+    snprintf(path, sizeof(path), "%s/.minishellrc", home);
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "alias ", 6) == 0 || strncmp(line, "unalias ", 8) == 0)
+            checkForAlias(line, dict);
+    }
+    fclose(file);
+}
+
+// Startup: use the snapshot unless ~/.minishellrc is newer, else rebuild from the rc
+void load_aliases(Dictionary* dict) {
+    char path[1024];
+    char rcPath[1024];
+    if (!alias_snapshot_path(path, sizeof(path)))
+        return;
+
+    struct stat snapSt, rcSt;
+    const char* home = getenv("HOME");
+    int haveRc = 0;
+    if (home != NULL) {
+        snprintf(rcPath, sizeof(rcPath), "%s/.minishellrc", home);
+        haveRc = stat(rcPath, &rcSt) == 0;
+    }
+    int haveSnap = stat(path, &snapSt) == 0;
+
+    if (haveSnap && !(haveRc && rcSt.st_mtime > snapSt.st_mtime) && load_alias_snapshot(dict, path)) {
+        aliasDirty = 0;
+        return;
+    }
+    if (haveRc) {
+        load_alias_rc(dict);
+        aliasDirty = 1;  // write a fresh snapshot on exit
+    }
+}
+
+// Attaches the shared alias segment named by $MINISHELL_SHM_ALIASES, else loads the private table
+void open_aliases(Dictionary* dict) {
+    const char* name = getenv("MINISHELL_SHM_ALIASES");
+    if (name != NULL && name[0] != '\0') {
+        aliasShm = shm_attach(name, dict);
+        if (aliasShm != NULL) {
+            // The segment holds the aliases now; the seed copy is not needed
+            freeDictionary(dict);
+            initDictionary(dict);
+            return;
+        }
+    }
+    load_aliases(dict);
+}
+
+// Resource limits applied to a child before execvp (0 = not limited)
+typedef struct JobLimits {
+    long memMB;       // RLIMIT_AS and cgroup memory.max, in megabytes
+    long cpuSec;      // RLIMIT_CPU, in seconds
+    long cpuPercent;  // cgroup cpu.max bandwidth, in percent of one core
+    long nofile;      // RLIMIT_NOFILE
+    long nproc;       // RLIMIT_NPROC
+} JobLimits;
+
 typedef struct Job {
     int job_id;
     pid_t pid;
-    char* command;
+    const char* command;
+    int placed;          // 1 if the job was pinned by the affinity setting
+    int placeCpu;        // pinned core (-1 when pinned to a whole node)
+    int placeNode;       // NUMA node of the placement
+    cpu_set_t placement; // core set applied in the child
+    int limited;         // 1 if the job runs under a limit prefix
+    JobLimits limits;
+    int cgroupId;        // cgroup v2 directory of the job (0 = rlimits only)
+    int64_t startTime;   // launch time, nanoseconds since the epoch
+    int64_t startClock;  // launch time on CLOCK_MONOTONIC, for the wall time
+    int pidfd;           // re-adopted after --restore: not our child, watched through this pidfd
     struct Job* next;
 } Job;
 
 // Global job_list
 Job* job_list = NULL;
+Pool jobPool = { "jobs", (sizeof(Job) + 15) & ~(size_t)15, NULL, NULL, 0, 0, 0, 0, 0 };
 int next_job_id = 1;
 
-void add_job(pid_t pid, const char* command) {
-    Job* job = (Job*)malloc(sizeof(Job));
-    if(job == NULL){
-        perror("malloc");
-        exit(EXIT_FAILURE);
+// Status page. Each shell publishes its counters, the foreground command and
+// the job table in /dev/shm/minishell-status.<pid> (layout in status_page.h),
+// where minishell-top reads them without involving the shell. Updates go
+// through a seqlock; a job change seen by the SIGCHLD handler while the main
+// path is mid-update is left pending and written when that update ends.
+StatusPage* statusPage = NULL;
+pid_t statusOwner = 0;      // the process that created the page and unlinks it
+char statusName[64];
+volatile sig_atomic_t statusWriting = 0;
+volatile sig_atomic_t statusJobsPending = 0;
+
+int64_t status_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void status_begin() {
+    statusWriting = 1;
+    __atomic_store_n(&statusPage->seq, statusPage->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void status_jobs();
+
+void status_end() {
+    statusPage->updated = status_clock();
+    __atomic_store_n(&statusPage->seq, statusPage->seq + 1, __ATOMIC_RELEASE);
+    statusWriting = 0;
+    if (statusJobsPending) {
+        statusJobsPending = 0;
+        status_jobs();
+    }
+}
+
+// Copies the job table; runs from the main path and from the SIGCHLD handler
+void status_jobs() {
+    if (statusPage == NULL)
+        return;
+    if (statusWriting) {
+        statusJobsPending = 1;
+        return;
+    }
+    status_begin();
+    int n = 0;
+    for (Job* current = job_list; current != NULL && n < STATUS_PAGE_JOBS; current = current->next, n++) {
+        StatusJob* slot = &statusPage->jobs[n];
+        slot->jobId = current->job_id;
+        slot->pid = current->pid;
+        slot->startTime = current->startTime;
+        strncpy(slot->command, current->command, sizeof(slot->command) - 1);
+        slot->command[sizeof(slot->command) - 1] = '\0';
+    }
+    statusPage->jobCount = n;
+    status_end();
+}
+
+void status_update(int succeeded, int lastStatus, int scriptLine, int aliasCount) {
+    if (statusPage == NULL)
+        return;
+    status_begin();
+    statusPage->succeeded = succeeded;
+    statusPage->lastStatus = lastStatus;
+    statusPage->scriptLine = scriptLine;
+    statusPage->aliasCount = aliasCount;
+    status_end();
+}
+
+// pid 0 clears the foreground command
+void status_foreground(pid_t pid, const char* command) {
+    if (statusPage == NULL)
+        return;
+    status_begin();
+    statusPage->foregroundPid = pid;
+    statusPage->foregroundStart = pid != 0 ? status_clock() : 0;
+    if (command != NULL)
+        snprintf(statusPage->foreground, sizeof(statusPage->foreground), "%s", command);
+    else
+        statusPage->foreground[0] = '\0';
+    status_end();
+}
+
+void status_close() {
+    if (statusPage == NULL)
+        return;
+    munmap(statusPage, sizeof(StatusPage));
+    statusPage = NULL;
+    if (statusOwner == getpid())
+        shm_unlink(statusName);
+}
+
+// Forked children that keep running shell code must not write the parent's page
+void status_detach() {
+    if (statusPage != NULL)
+        munmap(statusPage, sizeof(StatusPage));
+    statusPage = NULL;
+}
+
+// Creates this shell's page; $MINISHELL_STATUS set to an empty string turns it off
+void status_open() {
+    static int registered = 0;
+    const char* env = getenv("MINISHELL_STATUS");
+    if (env != NULL && env[0] == '\0')
+        return;
+    snprintf(statusName, sizeof(statusName), "/" STATUS_PAGE_PREFIX "%d", getpid());
+    int fd = shm_open(statusName, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return;
+    if (ftruncate(fd, sizeof(StatusPage)) == -1) {
+        close(fd);
+        shm_unlink(statusName);
+        return;
+    }
+    void* map = mmap(NULL, sizeof(StatusPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        shm_unlink(statusName);
+        return;
+    }
+    statusPage = (StatusPage*)map;
+    statusOwner = getpid();
+    statusPage->version = STATUS_PAGE_VERSION;
+    statusPage->pid = getpid();
+    statusPage->startTime = status_clock();
+    statusPage->updated = statusPage->startTime;
+    __atomic_store_n(&statusPage->magic, STATUS_PAGE_MAGIC, __ATOMIC_RELEASE);
+    if (!registered) {
+        atexit(status_close);
+        registered = 1;
     }
+}
+
+// Jobs and their commands come from pools, since remove_job runs in the
+// SIGCHLD handler; callers hold SIGCHLD blocked around add_job
+Job* add_job(pid_t pid, const char* command) {
+    Job* job = (Job*)pool_alloc(&jobPool);
     job->job_id = next_job_id++;
     job->pid = pid;
-    job->command = strdup(command); //using malloc
-    if(job->command == NULL){
-        perror("malloc");
-        free(job);
-        exit(EXIT_FAILURE);
-    }
+    if (interned.dead >= 64)
+        intern_sweep();
+    job->command = intern(command);  // repeated commands share one copy
+    job->placed = 0;
+    job->placeCpu = -1;
+    job->placeNode = -1;
+    CPU_ZERO(&job->placement);
+    job->limited = 0;
+    memset(&job->limits, 0, sizeof(job->limits));
+    job->cgroupId = 0;
+    job->pidfd = -1;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    job->startTime = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    job->startClock = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
     //job->next = job_list;
     //job_list = job;
 
@@ -190,6 +1544,8 @@ void add_job(pid_t pid, const char* command) {
         }
         current->next = job;
     }
+    status_jobs();
+    return job;
 }
 
 void remove_job(pid_t pid) {
@@ -205,8 +1561,11 @@ void remove_job(pid_t pid) {
         } else {
             previous->next = current->next;
         }
-        free(current->command); // Free the stored command string
-        free(current);
+        if (current->pidfd != -1)
+            close(current->pidfd);
+        intern_drop(current->command); // Release the shared command string
+        pool_free(&jobPool, current);
+        status_jobs();
     }
 
     // Reset next_job_id if job_list is empty
@@ -215,57 +1574,4624 @@ void remove_job(pid_t pid) {
     }
 }
 
+void print_pool(const Pool* pool) {
+    printf("%-14s %6zu %8ld %8ld %6ld %10zu\n", pool->name, pool->size, pool->live, pool->peak, pool->slabs,
+           pool->slabBytes);
+}
+
+void print_string_pool(const StringPool* strings) {
+    for (int i = 0; i < STRING_CLASSES; i++) {
+        if (strings->classes[i].slabs > 0)
+            print_pool(&strings->classes[i]);
+    }
+    if (strings->large > 0)
+        printf("%-14s %6s %8ld %8s %6s %10zu\n", strings->classes[0].name, ">1024", strings->large, "-", "-",
+               strings->largeBytes);
+}
+
+// memstats: pooled objects, malloc heap and resident set size
+void print_memstats() {
+    printf("%-14s %6s %8s %8s %6s %10s\n", "pool", "size", "live", "peak", "slabs", "bytes");
+    print_pool(&nodePool);
+    print_string_pool(&aliasStrings);
+    print_pool(&jobPool);
+    printf("%-14s %6s %8u %8s %6s %10zu  (%lu lookups, %lu shared)\n", "interned", "-", interned.count, "-", "-",
+           interned.bytes, interned.lookups, interned.shared);
+    printf("command paths: %lu hits, %lu misses\n", pathHits, pathMisses);
+    if (aliasShm != NULL) {
+        AliasShmHeader* header = aliasShm->header;
+        printf("alias segment: %u aliases, %u/%u slots, %llu/%llu arena bytes (%llu dead), generation %llu, %lu read retries\n",
+               header->count, header->used, header->slotCount, (unsigned long long)header->arenaUsed,
+               (unsigned long long)header->arenaSize, (unsigned long long)header->arenaDead,
+               (unsigned long long)header->generation, aliasShm->retries);
+    }
+
+    struct mallinfo2 heap = mallinfo2();
+    printf("heap: %zu bytes in use, %zu free, %zu mmapped\n", heap.uordblks, heap.fordblks, heap.hblkhd);
+
+    long pageKB = sysconf(_SC_PAGESIZE) / 1024;
+    long size = 0, resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL) {
+        if (fscanf(statm, "%ld %ld", &size, &resident) != 2)
+            resident = 0;
+        fclose(statm);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("rss: %ld KB, peak %ld KB\n", resident * pageKB, usage.ru_maxrss);
+}
+
 void print_jobs() {
     Job* current = job_list;
     while (current != NULL) {
-        printf("[%d] %d               %s\n", current->job_id, current->pid, current->command);
+        if (current->placed && current->placeCpu >= 0)
+            printf("[%d] %d               %s    cpu %d (node %d)\n", current->job_id, current->pid, current->command,
+                   current->placeCpu, current->placeNode);
+        else if (current->placed)
+            printf("[%d] %d               %s    node %d (%d cpus)\n", current->job_id, current->pid, current->command,
+                   current->placeNode, CPU_COUNT(&current->placement));
+        else
+            printf("[%d] %d               %s\n", current->job_id, current->pid, current->command);
+        if (current->pidfd != -1)
+            printf("    adopted after restore: exit status will be unknown\n");
+        if (current->limited)
+            printf("    limits: mem=%ldM cpu=%lds cpu.max=%ld%% nofile=%ld nproc=%ld%s\n",
+                   current->limits.memMB, current->limits.cpuSec, current->limits.cpuPercent,
+                   current->limits.nofile, current->limits.nproc, current->cgroupId ? " (cgroup)" : "");
         current = current->next;
     }
 }
-//Global Var for Succeeded command
-int succeededCMD = 0;
-int hasApos(char* str);
-char** split_string(const char *str, int *count);
-void free_split_string(char **str_array);
-int checkForAlias(char* input, Dictionary* dict);
 
-void execute_source_script(const char* filename, Dictionary* dict, int* scriptLine, int* aposCounter);
-void execute_general(char* input ,Dictionary* dict, int *aposCounter);
-int findEndFile (const char* filename);
-int check_logic_op(char** arr);
-void execute_logical_operator(char** arr, Dictionary* dict , int count, int* aposCounter);
-char* separate_command(char** arr , int* counter_per_command);
-char* check_redirect(char** arr, int count);
-void redirect_stderr (const char* fileName, int* prevDupVal);
-char* separate_befor_2arrow(char** arr);
+// Starts a detached helper thread with every signal blocked, so SIGCHLD
+// and friends are always handled by the main thread
+int start_helper_thread(void* (*fn)(void*), void* arg) {
+    sigset_t all, prev;
+    pthread_t thread;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &prev);
+    int rc = pthread_create(&thread, NULL, fn, arg);
+    pthread_sigmask(SIG_SETMASK, &prev, NULL);
+    if (rc != 0)
+        return 0;
+    pthread_detach(thread);
+    return 1;
+}
+
+// Background output capture. With "capture on", each background job writes
+// stdout/stderr into a pipe that a drain thread empties into a per-job ring.
+// Rings start in memory; a job whose output passes the ring size, or any job
+// once the global memory cap is reached, continues in an mmap'd spill file.
+#define CAPTURE_RING_SIZE (64 * 1024)          // in-memory ring per job
+#define CAPTURE_SPILL_SIZE (4 * 1024 * 1024)   // spill file ring per job
+#define CAPTURE_MEMORY_CAP (1024 * 1024)       // in-memory rings of all jobs together
+#define CAPTURE_MAX_RECORDS 64                 // finished captures kept for jobs -o
+
+typedef struct Capture {
+    int job_id;
+    pid_t pid;
+    char command[128];
+    int fd;             // read end of the job's pipe, -1 once it hit EOF
+    char* data;         // ring storage: malloc'd, or the spill mapping
+    size_t cap;
+    int spilled;
+    uint64_t total;     // bytes received; the ring holds the last min(total, cap)
+    struct Capture* next;
+} Capture;
+
+int captureEnabled = 0;
+Capture* captureList = NULL;    // newest first
+size_t captureMemoryUsed = 0;
+int captureEpollFd = -1;
+pthread_mutex_t captureLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Moves a ring to an unlinked, mmap'd temporary file; called with captureLock held
+int capture_spill(Capture* capture) {
+    char path[] = "/tmp/minishell-capture-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1)
+        return 0;
+    unlink(path);
+    if (ftruncate(fd, CAPTURE_SPILL_SIZE) == -1) {
+        close(fd);
+        return 0;
+    }
+    char* map = (char*)mmap(NULL, CAPTURE_SPILL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+
+    // Copy the retained bytes in order, so the ring restarts aligned at offset 0
+    size_t kept = capture->total < capture->cap ? (size_t)capture->total : capture->cap;
+    size_t start = (size_t)((capture->total - kept) % (capture->cap ? capture->cap : 1));
+    for (size_t i = 0; i < kept; i++)
+        map[i] = capture->data[(start + i) % capture->cap];
+    if (!capture->spilled) {
+        free(capture->data);
+        captureMemoryUsed -= capture->cap;
+    }
+    capture->data = map;
+    capture->cap = CAPTURE_SPILL_SIZE;
+    capture->spilled = 1;
+    capture->total = kept;
+    return 1;
+}
+
+void capture_append(Capture* capture, const char* bytes, size_t len) {
+    if (!capture->spilled && capture->total + len > capture->cap)
+        capture_spill(capture);
+    for (size_t i = 0; i < len; i++)
+        capture->data[(capture->total + i) % capture->cap] = bytes[i];
+    capture->total += len;
+}
+
+void capture_free(Capture* capture) {
+    if (capture->spilled)
+        munmap(capture->data, capture->cap);
+    else {
+        free(capture->data);
+        captureMemoryUsed -= capture->cap;
+    }
+    free(capture);
+}
+
+// Drops the oldest finished captures beyond CAPTURE_MAX_RECORDS; called with captureLock held
+void capture_trim() {
+    int kept = 0;
+    Capture** link = &captureList;
+    while (*link != NULL) {
+        Capture* capture = *link;
+        if (capture->fd == -1 && ++kept > CAPTURE_MAX_RECORDS) {
+            *link = capture->next;
+            capture_free(capture);
+            continue;
+        }
+        link = &capture->next;
+    }
+}
+
+// Drain thread: empties every ready pipe into its ring; never touches the main loop
+void* capture_drain(void* arg) {
+    (void)arg;
+    char chunk[16384];
+    struct epoll_event events[16];
+    while (1) {
+        int n = epoll_wait(captureEpollFd, events, 16, -1);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return NULL;
+        }
+        for (int i = 0; i < n; i++) {
+            Capture* capture = (Capture*)events[i].data.ptr;
+            pthread_mutex_lock(&captureLock);
+            ssize_t got = capture->fd != -1 ? read(capture->fd, chunk, sizeof(chunk)) : -1;
+            if (capture->fd == -1 || (got == -1 && errno == EAGAIN)) {
+                pthread_mutex_unlock(&captureLock);
+                continue;
+            }
+            if (got > 0) {
+                capture_append(capture, chunk, (size_t)got);
+            } else {
+                epoll_ctl(captureEpollFd, EPOLL_CTL_DEL, capture->fd, NULL);
+                close(capture->fd);
+                capture->fd = -1;
+                capture_trim();
+            }
+            pthread_mutex_unlock(&captureLock);
+        }
+    }
+}
+
+// Handles capture [on | off]
+int handle_capture(char** arr, int count) {
+    if (count == 1) {
+        int records = 0, running = 0, spilled = 0;
+        pthread_mutex_lock(&captureLock);
+        for (Capture* capture = captureList; capture != NULL; capture = capture->next) {
+            records++;
+            running += capture->fd != -1;
+            spilled += capture->spilled;
+        }
+        printf("capture %s: %d jobs (%d running, %d spilled), %zu/%d KB in memory\n", captureEnabled ? "on" : "off",
+               records, running, spilled, captureMemoryUsed / 1024, CAPTURE_MEMORY_CAP / 1024);
+        pthread_mutex_unlock(&captureLock);
+        return 1;
+    }
+    if (count != 2 || (strcmp(arr[1], "on") != 0 && strcmp(arr[1], "off") != 0)) {
+        fprintf(stderr, "ERR\n");
+        return 0;
+    }
+    captureEnabled = strcmp(arr[1], "on") == 0;
+    if (captureEnabled && captureEpollFd == -1) {
+        captureEpollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (captureEpollFd == -1 || !start_helper_thread(capture_drain, NULL)) {
+            perror("capture");
+            captureEnabled = 0;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// In a forked subshell: the epoll instance is shared with the parent's drain
+// thread, which must never see this process's Capture pointers, and the drain
+// thread itself did not survive the fork. Jobs started here are not captured.
+void capture_detach() {
+    if (captureEpollFd != -1)
+        close(captureEpollFd);
+    captureEpollFd = -1;
+    captureEnabled = 0;
+    captureList = NULL;   // the parent's records; the copies are left alone
+    pthread_mutex_init(&captureLock, NULL);   // may have been held by the drain thread
+}
+
+// Opens the pipe for a background job about to be forked; returns 0 if capture is off
+int capture_pipe(int fds[2]) {
+    if (!captureEnabled)
+        return 0;
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("pipe");
+        return 0;
+    }
+    return 1;
+}
+
+// Parent side after the fork: hands the read end to the drain thread
+void capture_start(int fd, int job_id, pid_t pid, const char* command) {
+    Capture* capture = (Capture*)calloc(1, sizeof(Capture));
+    if (capture == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    capture->job_id = job_id;
+    capture->pid = pid;
+    strncpy(capture->command, command, sizeof(capture->command) - 1);
+    capture->fd = fd;
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    pthread_mutex_lock(&captureLock);
+    // Stay under the global cap: spill finished in-memory rings first, then start this one on disk
+    for (Capture* other = captureList; other != NULL && captureMemoryUsed + CAPTURE_RING_SIZE > CAPTURE_MEMORY_CAP;
+         other = other->next) {
+        if (!other->spilled && other->fd == -1)
+            capture_spill(other);
+    }
+    if (captureMemoryUsed + CAPTURE_RING_SIZE <= CAPTURE_MEMORY_CAP) {
+        capture->data = (char*)malloc(CAPTURE_RING_SIZE);
+        if (capture->data == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        capture->cap = CAPTURE_RING_SIZE;
+        captureMemoryUsed += CAPTURE_RING_SIZE;
+    } else {
+        capture->cap = 1;
+        capture->data = (char*)malloc(1);
+        captureMemoryUsed += 1;
+        if (capture->data == NULL || !capture_spill(capture)) {
+            perror("capture");
+            exit(EXIT_FAILURE);
+        }
+    }
+    capture->next = captureList;
+    captureList = capture;
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = capture };
+    if (epoll_ctl(captureEpollFd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        perror("epoll_ctl");
+        close(fd);
+        capture->fd = -1;
+    }
+    pthread_mutex_unlock(&captureLock);
+}
+
+// jobs -o %N [LINES]: prints the last lines captured from a job (running, or recently finished)
+int print_capture(char** arr, int count) {
+    if (count < 3 || count > 4) {
+        fprintf(stderr, "ERR\n");
+        return 0;
+    }
+    int job_id = atoi(arr[2][0] == '%' ? arr[2] + 1 : arr[2]);
+    int lines = count == 4 ? atoi(arr[3]) : 20;
+    if (job_id <= 0 || lines <= 0) {
+        fprintf(stderr, "ERR\n");
+        return 0;
+    }
+
+    pthread_mutex_lock(&captureLock);
+    // Prefer the running job with that id; ids restart once the job list is empty
+    Capture* found = NULL;
+    for (Capture* capture = captureList; capture != NULL; capture = capture->next) {
+        if (capture->job_id == job_id && (found == NULL || (found->fd == -1 && capture->fd != -1)))
+            found = capture;
+    }
+    if (found == NULL) {
+        pthread_mutex_unlock(&captureLock);
+        fprintf(stderr, "ERR\n");
+        return 0;
+    }
+
+    size_t kept = found->total < found->cap ? (size_t)found->total : found->cap;
+    uint64_t first = found->total - kept;
+    // Walk back from the end to the start of the wanted last lines
+    uint64_t from = found->total;
+    int seen = 0;
+    while (from > first) {
+        char c = found->data[(from - 1) % found->cap];
+        if (c == '\n' && from != found->total && ++seen == lines)
+            break;
+        from--;
+    }
+    printf("[%d] %d %s (%s, %llu bytes)\n", found->job_id, found->pid, found->command,
+           found->fd == -1 ? "done" : "running", (unsigned long long)found->total);
+    for (uint64_t i = from; i < found->total; i++)
+        putchar(found->data[i % found->cap]);
+    if (found->total > 0 && found->data[(found->total - 1) % found->cap] != '\n')
+        putchar('\n');
+    pthread_mutex_unlock(&captureLock);
+    return 1;
+}
+
+// Affinity modes for background jobs
+#define AFFINITY_OFF  0
+#define AFFINITY_RR   1  // round-robin over the placement units
+#define AFFINITY_LOAD 2  // unit with the fewest running jobs
+#define MAX_NUMA_NODES 64
+
+int affinityMode = AFFINITY_OFF;
+int affinityByNode = 0;   // 0 - pin to single cores, 1 - pin to whole NUMA nodes
+int affinityNext = 0;     // round-robin cursor
+
+// NUMA topology read once from /sys/devices/system/node
+int numaLoaded = 0;
+int numaNodeCount = 0;
+int numaNodeIds[MAX_NUMA_NODES];
+cpu_set_t numaNodeCpus[MAX_NUMA_NODES];
+cpu_set_t shellCpus;      // cores the shell itself may run on
+
+// Parses a sysfs cpulist such as "0-3,8-11" into a cpu set
+void parse_cpulist(const char* list, cpu_set_t* set) {
+    CPU_ZERO(set);
+    const char* ptr = list;
+    while (*ptr && *ptr != '\n') {
+        char* end;
+        long first = strtol(ptr, &end, 10);
+        long last = first;
+        if (end == ptr)
+            break;
+        if (*end == '-')
+            last = strtol(end + 1, &end, 10);
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, set);
+        ptr = end;
+        if (*ptr == ',')
+            ptr++;
+    }
+}
+
+// Loads the NUMA node -> cpu mapping, falling back to a single node holding every allowed core
+void load_numa_topology() {
+    if (numaLoaded)
+        return;
+    numaLoaded = 1;
+
+    if (sched_getaffinity(0, sizeof(shellCpus), &shellCpus) == -1) {
+        perror("sched_getaffinity");
+        CPU_ZERO(&shellCpus);
+        for (long i = 0; i < sysconf(_SC_NPROCESSORS_ONLN) && i < CPU_SETSIZE; i++)
+            CPU_SET(i, &shellCpus);
+    }
+
+    DIR* dir = opendir("/sys/devices/system/node");
+    if (dir != NULL) {
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL && numaNodeCount < MAX_NUMA_NODES) {
+            if (strncmp(entry->d_name, "node", 4) != 0 || entry->d_name[4] < '0' || entry->d_name[4] > '9')
+                continue;
+            char path[300];
+            char list[1024];
+            snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", entry->d_name);
+            FILE* file = fopen(path, "r");
+            if (file == NULL)
+                continue;
+            if (fgets(list, sizeof(list), file) != NULL) {
+                cpu_set_t cpus;
+                parse_cpulist(list, &cpus);
+                CPU_AND(&cpus, &cpus, &shellCpus);
+                if (CPU_COUNT(&cpus) > 0) {
+                    numaNodeIds[numaNodeCount] = atoi(entry->d_name + 4);
+                    numaNodeCpus[numaNodeCount] = cpus;
+                    numaNodeCount++;
+                }
+            }
+            fclose(file);
+        }
+        closedir(dir);
+    }
+
+    if (numaNodeCount == 0) {
+        numaNodeIds[0] = 0;
+        numaNodeCpus[0] = shellCpus;
+        numaNodeCount = 1;
+    }
+}
+
+// Returns the index into numaNodeIds of the node holding the given core
+int node_of_cpu(int cpu) {
+    for (int i = 0; i < numaNodeCount; i++) {
+        if (CPU_ISSET(cpu, &numaNodeCpus[i]))
+            return i;
+    }
+    return 0;
+}
+
+// Counts the running jobs placed on a core (byNode == 0) or on a node index (byNode == 1)
+int jobs_on_unit(int unit, int byNode) {
+    int load = 0;
+    for (Job* current = job_list; current != NULL; current = current->next) {
+        if (!current->placed)
+            continue;
+        if (byNode ? current->placeNode == numaNodeIds[unit] : current->placeCpu == unit)
+            load++;
+    }
+    return load;
+}
+
+// Picks the placement for a new background job; returns 0 when affinity is off
+int choose_placement(cpu_set_t* set, int* cpu, int* node) {
+    if (affinityMode == AFFINITY_OFF)
+        return 0;
+    load_numa_topology();
+
+    // Placement units are either the allowed cores or the NUMA nodes
+    int units[CPU_SETSIZE];
+    int unitCount = 0;
+    if (affinityByNode) {
+        for (int i = 0; i < numaNodeCount; i++)
+            units[unitCount++] = i;
+    } else {
+        for (int i = 0; i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &shellCpus))
+                units[unitCount++] = i;
+        }
+    }
+    if (unitCount == 0)
+        return 0;
+
+    int pick = affinityNext % unitCount;
+    if (affinityMode == AFFINITY_LOAD) {
+        // Start the scan at the round-robin cursor so ties spread out
+        int best = -1;
+        for (int k = 0; k < unitCount; k++) {
+            int idx = (affinityNext + k) % unitCount;
+            int load = jobs_on_unit(units[idx], affinityByNode);
+            if (best == -1 || load < best) {
+                best = load;
+                pick = idx;
+            }
+        }
+    }
+    affinityNext = pick + 1;
+
+    if (affinityByNode) {
+        *set = numaNodeCpus[units[pick]];
+        *cpu = -1;
+        *node = numaNodeIds[units[pick]];
+    } else {
+        CPU_ZERO(set);
+        CPU_SET(units[pick], set);
+        *cpu = units[pick];
+        *node = numaNodeIds[node_of_cpu(units[pick])];
+    }
+    return 1;
+}
+
+// Handles the affinity builtin: affinity [off | rr [cpu|node] | load [cpu|node]]
+int handle_affinity(char** arr, int count) {
+    if (count == 1) {
+        load_numa_topology();
+        const char* mode = affinityMode == AFFINITY_RR ? "rr" : affinityMode == AFFINITY_LOAD ? "load" : "off";
+        printf("affinity %s %s\n", mode, affinityByNode ? "node" : "cpu");
+        for (int i = 0; i < numaNodeCount; i++) {
+            printf("node %d:", numaNodeIds[i]);
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &numaNodeCpus[i]))
+                    printf(" %d", cpu);
+            }
+            printf("\n");
+        }
+        return 1;
+    }
+    if (count > 3) {
+        fprintf(stderr, "ERR\n");
+        return 0;
+    }
+
+    int mode;
+    if (strcmp(arr[1], "off") == 0)
+        mode = AFFINITY_OFF;
+    else if (strcmp(arr[1], "rr") == 0)
+        mode = AFFINITY_RR;
+    else if (strcmp(arr[1], "load") == 0)
+        mode = AFFINITY_LOAD;
+    else {
+        fprintf(stderr, "ERR\n");
+        return 0;
+    }
+
+    int byNode = affinityByNode;
+    if (count == 3) {
+        if (strcmp(arr[2], "cpu") == 0)
+            byNode = 0;
+        else if (strcmp(arr[2], "node") == 0)
+            byNode = 1;
+        else {
+            fprintf(stderr, "ERR\n");
+            return 0;
+        }
+    }
+    affinityMode = mode;
+    affinityByNode = byNode;
+    affinityNext = 0;
+    return 1;
+}
+// Limits of the command line currently being executed (set by the limit prefix)
+JobLimits* activeLimits = NULL;
+
+// cgroup v2 state: -1 unknown, 0 unavailable, 1 usable
+int cgroupState = -1;
+char cgroupBase[400];    // the cgroup the shell started in
+char cgroupDir[512];     // per-shell parent directory of the job cgroups
+int nextCgroupId = 1;
+
+// A job cgroup that has not been removed yet, kept apart from the job table
+// so it is cleaned up even when no job or report refers to it any more
+typedef struct JobCgroup {
+    int id;
+    JobLimits limits;
+    char command[128];
+} JobCgroup;
+
+JobCgroup* jobCgroups = NULL;
+int jobCgroupCount = 0, jobCgroupCapacity = 0;
+
+// A limited background job that was reaped and still has to be checked
+typedef struct LimitReport {
+    int job_id;
+    pid_t pid;
+    int status;
+    JobLimits limits;
+    int cgroupId;
+    char command[128];
+} LimitReport;
+
+#define MAX_LIMIT_REPORTS 64
+#define MAX_VIOLATIONS 16
+LimitReport pendingLimitReports[MAX_LIMIT_REPORTS];
+volatile int pendingLimitCount = 0;
+char recentViolations[MAX_VIOLATIONS][192];
+int violationCount = 0;
+
+// Writes a short string to a file, returns 0 on success
+int write_file(const char* path, const char* text) {
+    int fd = open(path, O_WRONLY);
+    if (fd == -1)
+        return -1;
+    ssize_t len = (ssize_t)strlen(text);
+    ssize_t written = write(fd, text, len);
+    close(fd);
+    return written == len ? 0 : -1;
+}
+
+// Finds the cgroup v2 hierarchy and the shell's own cgroup in it (cgroupBase)
+int cgroup_find_base() {
+    const char* mount = NULL;
+    if (access("/sys/fs/cgroup/cgroup.controllers", F_OK) == 0)
+        mount = "/sys/fs/cgroup";
+    else if (access("/sys/fs/cgroup/unified/cgroup.controllers", F_OK) == 0)
+        mount = "/sys/fs/cgroup/unified";
+    if (mount == NULL)
+        return 0;
+
+    // Our own cgroup is the "0::<path>" line of /proc/self/cgroup
+    char self[256] = "";
+    char line[512];
+    FILE* file = fopen("/proc/self/cgroup", "r");
+    if (file == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, "0::", 3) == 0) {
+            strncpy(self, line + 3, sizeof(self) - 1);
+            self[sizeof(self) - 1] = '\0';
+            self[strcspn(self, "\n")] = '\0';
+        }
+    }
+    fclose(file);
+    snprintf(cgroupBase, sizeof(cgroupBase), "%s%s", mount, strcmp(self, "/") == 0 ? "" : self);
+    return 1;
+}
+
+// Whether cgroup_init could set up job groups, without changing anything
+int cgroup_probe() {
+    if (cgroupState != -1)
+        return cgroupState;
+    if (!cgroup_find_base())
+        return 0;
+    char path[600];
+    snprintf(path, sizeof(path), "%s/cgroup.subtree_control", cgroupBase);
+    return access(cgroupBase, W_OK) == 0 && access(path, W_OK) == 0;
+}
+
+// Prepares a directory for this shell's jobs; called for the first job that
+// needs memory.max or cpu.max
+int cgroup_init() {
+    if (cgroupState != -1)
+        return cgroupState;
+    cgroupState = 0;
+    if (!cgroup_find_base())
+        return 0;
+
+    char path[600];
+    char leaf[560];
+    char pid[32];
+    snprintf(cgroupDir, sizeof(cgroupDir), "%s/minishell-%d", cgroupBase, getpid());
+    snprintf(leaf, sizeof(leaf), "%s/shell", cgroupDir);
+    snprintf(pid, sizeof(pid), "%d", getpid());
+    if (mkdir(cgroupDir, 0755) == -1 && errno != EEXIST)
+        return 0;
+
+    // A cgroup that holds processes cannot enable controllers for its
+    // children, so the shell moves into a leaf of its own first:
+    // base/minishell-<pid>/shell next to the job-<n> groups
+    snprintf(path, sizeof(path), "%s/cgroup.procs", leaf);
+    if ((mkdir(leaf, 0755) == -1 && errno != EEXIST) || write_file(path, pid) != 0) {
+        rmdir(leaf);
+        rmdir(cgroupDir);
+        return 0;
+    }
+
+    // Delegate the controllers down to the job directories; either write may
+    // already be in place (or fail because other processes still live in the
+    // base group), so only the presence of memory.max decides below
+    snprintf(path, sizeof(path), "%s/cgroup.subtree_control", cgroupBase);
+    write_file(path, "+memory +cpu");
+    snprintf(path, sizeof(path), "%s/cgroup.subtree_control", cgroupDir);
+    write_file(path, "+memory +cpu");
+    snprintf(path, sizeof(path), "%s/memory.max", leaf);
+    if (access(path, F_OK) != 0) {
+        snprintf(path, sizeof(path), "%s/cgroup.procs", cgroupBase);
+        write_file(path, pid);
+        rmdir(leaf);
+        rmdir(cgroupDir);
+        return 0;
+    }
+    cgroupState = 1;
+    return 1;
+}
+
+void cgroup_job_path(int cgroupId, const char* file, char* out, size_t size) {
+    if (file == NULL)
+        snprintf(out, size, "%s/job-%d", cgroupDir, cgroupId);
+    else
+        snprintf(out, size, "%s/job-%d/%s", cgroupDir, cgroupId, file);
+}
+
+// Creates the cgroup of a new job; returns its id or 0 to fall back to rlimits only
+int cgroup_create_job(const JobLimits* limits, const char* command) {
+    if ((limits->memMB == 0 && limits->cpuPercent == 0) || cgroup_init() == 0)
+        return 0;
+
+    int id = nextCgroupId++;
+    char path[700];
+    char value[64];
+    cgroup_job_path(id, NULL, path, sizeof(path));
+    if (mkdir(path, 0755) == -1)
+        return 0;
+
+    int ok = 1;
+    if (limits->memMB > 0) {
+        snprintf(value, sizeof(value), "%ld", limits->memMB * 1024 * 1024);
+        cgroup_job_path(id, "memory.max", path, sizeof(path));
+        ok = ok && write_file(path, value) == 0;
+    }
+    if (limits->cpuPercent > 0) {
+        snprintf(value, sizeof(value), "%ld 100000", limits->cpuPercent * 1000);
+        cgroup_job_path(id, "cpu.max", path, sizeof(path));
+        ok = ok && write_file(path, value) == 0;
+    }
+    if (!ok) {
+        cgroup_job_path(id, NULL, path, sizeof(path));
+        rmdir(path);
+        return 0;
+    }
+
+    if (jobCgroupCount == jobCgroupCapacity) {
+        int capacity = jobCgroupCapacity ? jobCgroupCapacity * 2 : 16;
+        JobCgroup* grown = (JobCgroup*)realloc(jobCgroups, capacity * sizeof(JobCgroup));
+        if (grown == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        jobCgroups = grown;
+        jobCgroupCapacity = capacity;
+    }
+    JobCgroup* entry = &jobCgroups[jobCgroupCount++];
+    entry->id = id;
+    entry->limits = *limits;
+    strncpy(entry->command, command, sizeof(entry->command) - 1);
+    entry->command[sizeof(entry->command) - 1] = '\0';
+    return id;
+}
+
+// Runs in the child: moves it into its cgroup and applies the rlimits
+void apply_limits(const JobLimits* limits, int cgroupId) {
+    if (cgroupId) {
+        char path[700];
+        char pid[32];
+        cgroup_job_path(cgroupId, "cgroup.procs", path, sizeof(path));
+        snprintf(pid, sizeof(pid), "%d", getpid());
+        if (write_file(path, pid) != 0)
+            perror("cgroup.procs");
+    }
+
+    struct rlimit rl;
+    if (limits->memMB > 0) {
+        rl.rlim_cur = rl.rlim_max = (rlim_t)limits->memMB * 1024 * 1024;
+        if (setrlimit(RLIMIT_AS, &rl) == -1)
+            perror("setrlimit");
+    }
+    if (limits->cpuSec > 0) {
+        // SIGXCPU at the soft limit, SIGKILL one second later
+        rl.rlim_cur = (rlim_t)limits->cpuSec;
+        rl.rlim_max = (rlim_t)limits->cpuSec + 1;
+        if (setrlimit(RLIMIT_CPU, &rl) == -1)
+            perror("setrlimit");
+    }
+    if (limits->nofile > 0) {
+        rl.rlim_cur = rl.rlim_max = (rlim_t)limits->nofile;
+        if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+            perror("setrlimit");
+    }
+    if (limits->nproc > 0) {
+        rl.rlim_cur = rl.rlim_max = (rlim_t)limits->nproc;
+        if (setrlimit(RLIMIT_NPROC, &rl) == -1)
+            perror("setrlimit");
+    }
+}
+
+// Reads the oom_kill counter of a job cgroup
+long cgroup_oom_kills(int cgroupId) {
+    char path[700];
+    char line[128];
+    long kills = 0;
+    cgroup_job_path(cgroupId, "memory.events", path, sizeof(path));
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, "oom_kill ", 9) == 0)
+            kills = atol(line + 9);
+    }
+    fclose(file);
+    return kills;
+}
+
+// Decides which limit (if any) ended the job, records it, and removes its cgroup
+void check_limit_violation(int job_id, const char* command, int status, const JobLimits* limits, int cgroupId) {
+    const char* what = NULL;
+    if (cgroupId && cgroup_oom_kills(cgroupId) > 0)
+        what = "memory.max";
+    else if (WIFSIGNALED(status) && WTERMSIG(status) == SIGXCPU)
+        what = "cpu time";
+    else if (WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL && limits->cpuSec > 0)
+        what = "cpu time";
+    else if (WIFSIGNALED(status) && limits->memMB > 0 &&
+             (WTERMSIG(status) == SIGSEGV || WTERMSIG(status) == SIGABRT))
+        what = "address space";
+
+    if (what != NULL) {
+        char* slot = recentViolations[violationCount % MAX_VIOLATIONS];
+        if (job_id > 0)
+            snprintf(slot, sizeof(recentViolations[0]), "[%d] limit exceeded (%s): %s", job_id, what, command);
+        else
+            snprintf(slot, sizeof(recentViolations[0]), "limit exceeded (%s): %s", what, command);
+        violationCount++;
+        fprintf(stderr, "%s\n", slot);
+    }
+
+    if (cgroupId) {
+        char path[700];
+        cgroup_job_path(cgroupId, NULL, path, sizeof(path));
+        rmdir(path);
+        for (int i = 0; i < jobCgroupCount; i++) {
+            if (jobCgroups[i].id == cgroupId) {
+                jobCgroups[i] = jobCgroups[--jobCgroupCount];
+                break;
+            }
+        }
+    }
+}
+
+// Whether a job cgroup still has processes in it
+int cgroup_populated(int cgroupId) {
+    char path[700];
+    char line[128];
+    int populated = 0;
+    cgroup_job_path(cgroupId, "cgroup.events", path, sizeof(path));
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, "populated ", 10) == 0)
+            populated = atoi(line + 10);
+    }
+    fclose(file);
+    return populated;
+}
+
+// Checks and removes the job cgroups whose job was reaped without a report
+// (the report queue was full, or the pid was not in the job table); called
+// with SIGCHLD blocked
+void cgroup_sweep() {
+    for (int i = jobCgroupCount - 1; i >= 0; i--) {
+        int id = jobCgroups[i].id, owned = 0;
+        for (Job* current = job_list; current != NULL && !owned; current = current->next)
+            owned = current->cgroupId == id;
+        for (int r = 0; r < pendingLimitCount && !owned; r++)
+            owned = pendingLimitReports[r].cgroupId == id;
+        if (owned || cgroup_populated(id))
+            continue;
+        JobCgroup orphan = jobCgroups[i];
+        check_limit_violation(0, orphan.command, 0, &orphan.limits, orphan.id);
+    }
+}
+
+// Called from sigHandler: queues a reaped limited job for checking outside signal context
+void queue_limit_report(const Job* job, int status) {
+    if (pendingLimitCount >= MAX_LIMIT_REPORTS)
+        return;
+    LimitReport* report = &pendingLimitReports[pendingLimitCount];
+    report->job_id = job->job_id;
+    report->pid = job->pid;
+    report->status = status;
+    report->limits = job->limits;
+    report->cgroupId = job->cgroupId;
+    strncpy(report->command, job->command, sizeof(report->command) - 1);
+    report->command[sizeof(report->command) - 1] = '\0';
+    pendingLimitCount++;
+}
+
+// Reports limit violations of background jobs reaped since the last prompt
+void report_limit_violations() {
+    if (pendingLimitCount == 0 && jobCgroupCount == 0)
+        return;
+    sigset_t block, prev;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &prev);
+    for (int i = 0; i < pendingLimitCount; i++) {
+        LimitReport* report = &pendingLimitReports[i];
+        check_limit_violation(report->job_id, report->command, report->status, &report->limits, report->cgroupId);
+    }
+    pendingLimitCount = 0;
+    cgroup_sweep();
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+// Parses "limit [-m MB] [-t SEC] [-c PERCENT] [-n NOFILE] [-p NPROC]";
+// returns the number of tokens consumed or -1 on a malformed option
+int parse_limits(char** arr, int count, JobLimits* limits) {
+    memset(limits, 0, sizeof(*limits));
+    int i = 1;
+    while (i + 1 < count && arr[i][0] == '-' && strlen(arr[i]) == 2) {
+        char* end;
+        long value = strtol(arr[i + 1], &end, 10);
+        if (*end != '\0' || value <= 0)
+            return -1;
+        switch (arr[i][1]) {
+            case 'm': limits->memMB = value; break;
+            case 't': limits->cpuSec = value; break;
+            case 'c': limits->cpuPercent = value; break;
+            case 'n': limits->nofile = value; break;
+            case 'p': limits->nproc = value; break;
+            default: return -1;
+        }
+        i += 2;
+    }
+    return i;
+}
+
+// Prints cgroup availability and the most recent limit violations; the job
+// groups are only set up once a job needs them
+void print_limit_status() {
+    if (cgroupState == 1)
+        printf("cgroup v2: %s\n", cgroupDir);
+    else if (cgroup_probe())
+        printf("cgroup v2: %s (writable, set up on the first -m/-c job)\n", cgroupBase);
+    else
+        printf("cgroup v2: unavailable (rlimits only)\n");
+    int first = violationCount > MAX_VIOLATIONS ? violationCount - MAX_VIOLATIONS : 0;
+    for (int i = first; i < violationCount; i++)
+        printf("%s\n", recentViolations[i % MAX_VIOLATIONS]);
+}
+
+// Removes this shell's cgroup directories on exit (job directories are removed
+// as jobs finish). The shell has to leave its leaf first; if the base group
+// now delegates controllers it cannot take processes, and the leaf is left
+// for whoever manages the base group.
+void cgroup_cleanup() {
+    if (cgroupState != 1)
+        return;
+    char path[600];
+    char pid[32];
+    snprintf(path, sizeof(path), "%s/cgroup.procs", cgroupBase);
+    snprintf(pid, sizeof(pid), "%d", getpid());
+    if (write_file(path, pid) != 0)
+        return;
+    for (int i = 0; i < jobCgroupCount; i++) {
+        cgroup_job_path(jobCgroups[i].id, NULL, path, sizeof(path));
+        rmdir(path);
+    }
+    snprintf(path, sizeof(path), "%s/shell", cgroupDir);
+    rmdir(path);
+    rmdir(cgroupDir);
+}
+
+// Command history: an append-only log of records, each followed by the
+// NUL-terminated line padded to 8 bytes. Appends are single O_APPEND writes
+// under flock, so several shells can share one log.
+#define HISTORY_MAGIC "MSHI"
+#define HISTORY_RECORD_MAGIC 0x52485349u
+#define HISTORY_VERSION 1
+
+typedef struct HistoryFileHeader {
+    char magic[4];
+    uint32_t version;
+} HistoryFileHeader;
+
+typedef struct HistoryRecord {
+    uint32_t magic;      // HISTORY_RECORD_MAGIC, used to skip torn records
+    uint32_t length;     // length of the line without the '\0'
+    int64_t timestamp;   // start time, nanoseconds since the epoch
+    int64_t duration;    // wall time in nanoseconds
+    int32_t status;      // exit status, 128+signal, or -1 for a background launch
+    uint32_t reserved;
+} HistoryRecord;
+
+// Persisted index, kept next to the log as <log>.idx: the record offsets in
+// log order, the offsets sorted by line (prefix search) and a suffix array
+// over the lines (substring search), all as uint32_t log offsets. It is
+// rebuilt by merging, written to a temporary file and renamed, so readers
+// keep a consistent mapping; records appended after it live in memory until
+// there are enough of them to be worth another merge.
+#define HISTORY_INDEX_MAGIC "MSHX"
+#define HISTORY_INDEX_VERSION 1
+#define HISTORY_TAIL_MIN 256     // merge the tail once it has this many records
+#define HISTORY_TAIL_SHARE 8     // ... and at least 1/8 of the indexed records
+
+typedef struct HistoryIndexHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t logDev, logIno;   // the log the offsets point into
+    uint64_t logSize;          // bytes of the log covered
+    uint64_t recordCount;      // entries of the records and sorted arrays
+    uint64_t suffixCount;
+} HistoryIndexHeader;
+
+// Reader state: the mapped log, the mapped index and the in-memory index of
+// the records appended after it (the tail)
+typedef struct HistoryIndex {
+    int fd;
+    char* map;
+    size_t mapSize;
+    size_t scanned;        // bytes of the log already indexed
+    dev_t logDev;
+    ino_t logIno;
+    char* indexMap;
+    size_t indexMapSize;
+    ino_t indexIno;
+    const uint32_t* indexRecords;
+    const uint32_t* indexSorted;
+    const uint32_t* indexSuffixes;
+    size_t indexRecordCount, indexSuffixCount;
+    size_t indexLogSize;   // the tail starts here
+    uint32_t* records;     // offsets of the tail records, in log order
+    size_t recordCount, recordCap;
+    uint32_t* sorted;      // tail record offsets sorted by line
+    size_t sortedCount;
+    uint32_t* suffixes;    // suffix array over the tail lines
+    size_t suffixCount, suffixCap;
+    size_t suffixRecords;  // tail records already covered by the suffix array
+} HistoryIndex;
+
+HistoryIndex history = { .fd = -1 };
+char historyPath[1024] = "";
+
+// History path: $MINISHELL_HISTORY, else ~/.minishell_history; returns 0 when history is off
+int history_path() {
+    if (historyPath[0] != '\0')
+        return 1;
+    const char* env = getenv("MINISHELL_HISTORY");
+    if (env != NULL) {
+        if (env[0] == '\0')
+            return 0;
+        snprintf(historyPath, sizeof(historyPath), "%s", env);
+        return 1;
+    }
+    const char* home = getenv("HOME");
+    if (home == NULL)
+        return 0;
+    snprintf(historyPath, sizeof(historyPath), "%s/.minishell_history", home);
+    return 1;
+}
+
+int64_t now_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Appends one executed line to the log
+void history_append(const char* line, int64_t timestamp, int64_t duration, int status) {
+    if (!history_path())
+        return;
+    int fd = open(historyPath, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (fd == -1)
+        return;
+
+    size_t length = strlen(line);
+    size_t padded = (sizeof(HistoryRecord) + length + 1 + 7) & ~(size_t)7;
+    char buffer[sizeof(HistoryFileHeader) + sizeof(HistoryRecord) + 1024 + 8];
+    if (length > 1024) {
+        close(fd);
+        return;
+    }
+
+    flock(fd, LOCK_EX);
+    size_t offset = 0;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size == 0) {
+        // First writer creates the file header
+        HistoryFileHeader header;
+        memcpy(header.magic, HISTORY_MAGIC, 4);
+        header.version = HISTORY_VERSION;
+        memcpy(buffer, &header, sizeof(header));
+        offset = sizeof(header);
+    }
+    HistoryRecord record;
+    record.magic = HISTORY_RECORD_MAGIC;
+    record.length = (uint32_t)length;
+    record.timestamp = timestamp;
+    record.duration = duration;
+    record.status = status;
+    record.reserved = 0;
+    memset(buffer + offset, 0, padded);
+    memcpy(buffer + offset, &record, sizeof(record));
+    memcpy(buffer + offset + sizeof(record), line, length);
+    if (write(fd, buffer, offset + padded) == -1)
+        perror("history");
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+// Returns the line stored in the record at the given offset
+const char* history_line(uint32_t offset) {
+    return history.map + offset + sizeof(HistoryRecord);
+}
+
+size_t history_count() {
+    return history.indexRecordCount + history.recordCount;
+}
+
+// Log offset of the index-th record, oldest first
+uint32_t history_record(size_t index) {
+    if (index < history.indexRecordCount)
+        return history.indexRecords[index];
+    return history.records[index - history.indexRecordCount];
+}
+
+void history_unmap_index() {
+    if (history.indexMap != NULL)
+        munmap(history.indexMap, history.indexMapSize);
+    history.indexMap = NULL;
+    history.indexMapSize = 0;
+    history.indexIno = 0;
+    history.indexRecords = history.indexSorted = history.indexSuffixes = NULL;
+    history.indexRecordCount = history.indexSuffixCount = 0;
+    history.indexLogSize = 0;
+}
+
+void history_index_path(char* out, size_t size) {
+    snprintf(out, size, "%s.idx", historyPath);
+}
+
+// Maps <log>.idx if it belongs to the mapped log and covers more of it than
+// what is indexed now; the tail is dropped and rescanned from the index's end
+void history_load_index() {
+    char path[1100];
+    history_index_path(path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_ino == history.indexIno || (size_t)st.st_size < sizeof(HistoryIndexHeader)) {
+        close(fd);
+        return;
+    }
+    char* map = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return;
+    HistoryIndexHeader header;
+    memcpy(&header, map, sizeof(header));
+    size_t expected = sizeof(header) + (2 * header.recordCount + header.suffixCount) * sizeof(uint32_t);
+    if (memcmp(header.magic, HISTORY_INDEX_MAGIC, 4) != 0 || header.version != HISTORY_INDEX_VERSION ||
+        header.logDev != (uint64_t)history.logDev || header.logIno != (uint64_t)history.logIno ||
+        header.logSize > history.mapSize || header.logSize <= history.indexLogSize ||
+        (size_t)st.st_size != expected) {
+        munmap(map, st.st_size);
+        return;
+    }
+
+    history_unmap_index();
+    history.indexMap = map;
+    history.indexMapSize = st.st_size;
+    history.indexIno = st.st_ino;
+    history.indexRecords = (const uint32_t*)(map + sizeof(header));
+    history.indexSorted = history.indexRecords + header.recordCount;
+    history.indexSuffixes = history.indexSorted + header.recordCount;
+    history.indexRecordCount = header.recordCount;
+    history.indexSuffixCount = header.suffixCount;
+    history.indexLogSize = header.logSize;
+    history.scanned = header.logSize;
+    history.recordCount = history.sortedCount = history.suffixCount = history.suffixRecords = 0;
+}
+
+// Remaps the log if it grew and indexes the new records; returns 0 if there is no log
+int history_refresh() {
+    if (!history_path())
+        return 0;
+    if (history.fd == -1) {
+        history.fd = open(historyPath, O_RDONLY);
+        if (history.fd == -1)
+            return 0;
+    }
+    struct stat st;
+    if (fstat(history.fd, &st) == -1 || (size_t)st.st_size < sizeof(HistoryFileHeader))
+        return 0;
+    if (st.st_size > UINT32_MAX) {
+        fprintf(stderr, "ERR\n");
+        return 0;
+    }
+    if ((size_t)st.st_size != history.mapSize) {
+        if (history.map != NULL)
+            munmap(history.map, history.mapSize);
+        history.map = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, history.fd, 0);
+        if (history.map == MAP_FAILED) {
+            history.map = NULL;
+            history.mapSize = 0;
+            return 0;
+        }
+        history.mapSize = st.st_size;
+    }
+    if (history.scanned == 0) {
+        if (memcmp(history.map, HISTORY_MAGIC, 4) != 0)
+            return 0;
+        history.scanned = sizeof(HistoryFileHeader);
+        history.logDev = st.st_dev;
+        history.logIno = st.st_ino;
+    }
+    // Another shell may have merged a newer index
+    history_load_index();
+
+    // Walk the records appended since the last refresh
+    size_t pos = history.scanned;
+    while (pos + sizeof(HistoryRecord) <= history.mapSize) {
+        HistoryRecord record;
+        memcpy(&record, history.map + pos, sizeof(record));
+        size_t padded = (sizeof(HistoryRecord) + record.length + 1 + 7) & ~(size_t)7;
+        if (record.magic != HISTORY_RECORD_MAGIC || pos + padded > history.mapSize) {
+            pos += 8;  // resynchronize on the next 8-byte boundary
+            continue;
+        }
+        if (history.recordCount == history.recordCap) {
+            history.recordCap = history.recordCap ? history.recordCap * 2 : 1024;
+            history.records = (uint32_t*)realloc(history.records, history.recordCap * sizeof(uint32_t));
+            if (history.records == NULL) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        history.records[history.recordCount++] = (uint32_t)pos;
+        pos += padded;
+    }
+    history.scanned = pos;
+    return 1;
+}
+
+int compare_history_lines(const void* a, const void* b) {
+    return strcmp(history_line(*(const uint32_t*)a), history_line(*(const uint32_t*)b));
+}
+
+int compare_history_suffixes(const void* a, const void* b) {
+    return strcmp(history.map + *(const uint32_t*)a, history.map + *(const uint32_t*)b);
+}
+
+// Sorts the new entries of an index and merges them into the sorted prefix
+void merge_sorted(uint32_t* items, size_t oldCount, size_t newCount, int (*cmp)(const void*, const void*)) {
+    qsort(items + oldCount, newCount - oldCount, sizeof(uint32_t), cmp);
+    if (oldCount == 0 || newCount == oldCount)
+        return;
+    uint32_t* merged = (uint32_t*)malloc(newCount * sizeof(uint32_t));
+    if (merged == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    size_t i = 0, j = oldCount, k = 0;
+    while (i < oldCount && j < newCount)
+        merged[k++] = cmp(&items[i], &items[j]) <= 0 ? items[i++] : items[j++];
+    while (i < oldCount)
+        merged[k++] = items[i++];
+    while (j < newCount)
+        merged[k++] = items[j++];
+    memcpy(items, merged, newCount * sizeof(uint32_t));
+    free(merged);
+}
+
+// Brings the tail's prefix index up to date with its record list
+void history_update_sorted() {
+    if (history.sortedCount == history.recordCount)
+        return;
+    history.sorted = (uint32_t*)realloc(history.sorted, history.recordCount * sizeof(uint32_t));
+    if (history.sorted == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(history.sorted + history.sortedCount, history.records + history.sortedCount,
+           (history.recordCount - history.sortedCount) * sizeof(uint32_t));
+    merge_sorted(history.sorted, history.sortedCount, history.recordCount, compare_history_lines);
+    history.sortedCount = history.recordCount;
+}
+
+// Brings the tail's suffix array up to date with its record list
+void history_update_suffixes() {
+    size_t oldCount = history.suffixCount;
+    for (size_t r = history.suffixRecords; r < history.recordCount; r++) {
+        uint32_t start = history.records[r] + sizeof(HistoryRecord);
+        size_t length = strlen(history.map + start);
+        if (history.suffixCount + length > history.suffixCap) {
+            history.suffixCap = (history.suffixCount + length) * 2;
+            history.suffixes = (uint32_t*)realloc(history.suffixes, history.suffixCap * sizeof(uint32_t));
+            if (history.suffixes == NULL) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (size_t i = 0; i < length; i++)
+            history.suffixes[history.suffixCount++] = start + (uint32_t)i;
+    }
+    history.suffixRecords = history.recordCount;
+    merge_sorted(history.suffixes, oldCount, history.suffixCount, compare_history_suffixes);
+}
+
+// Writes the merge of two sorted offset arrays
+int write_merged(FILE* out, const uint32_t* a, size_t aCount, const uint32_t* b, size_t bCount,
+                 int (*cmp)(const void*, const void*)) {
+    size_t i = 0, j = 0;
+    while (i < aCount || j < bCount) {
+        const uint32_t* next = j == bCount || (i < aCount && cmp(&a[i], &b[j]) <= 0) ? &a[i++] : &b[j++];
+        if (fwrite(next, sizeof(uint32_t), 1, out) != 1)
+            return 0;
+    }
+    return 1;
+}
+
+// Merges the tail into a new <log>.idx once it is big enough. Two shells
+// merging at once each rename a complete index; the later one wins.
+void history_merge_tail() {
+    if (history.recordCount < HISTORY_TAIL_MIN || history.recordCount * HISTORY_TAIL_SHARE < history.indexRecordCount)
+        return;
+    history_update_sorted();
+    history_update_suffixes();
+
+    char path[1100];
+    char tmpPath[1200];
+    history_index_path(path, sizeof(path));
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp.%d", path, getpid());
+    FILE* out = fopen(tmpPath, "w");
+    if (out == NULL)
+        return;   // a read-only directory just keeps the index in memory
+    HistoryIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HISTORY_INDEX_MAGIC, 4);
+    header.version = HISTORY_INDEX_VERSION;
+    header.logDev = history.logDev;
+    header.logIno = history.logIno;
+    header.logSize = history.scanned;
+    header.recordCount = history_count();
+    header.suffixCount = history.indexSuffixCount + history.suffixCount;
+    int ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+             fwrite(history.indexRecords, sizeof(uint32_t), history.indexRecordCount, out) == history.indexRecordCount &&
+             fwrite(history.records, sizeof(uint32_t), history.recordCount, out) == history.recordCount &&
+             write_merged(out, history.indexSorted, history.indexRecordCount, history.sorted, history.sortedCount,
+                          compare_history_lines) &&
+             write_merged(out, history.indexSuffixes, history.indexSuffixCount, history.suffixes, history.suffixCount,
+                          compare_history_suffixes);
+    if (fclose(out) != 0 || !ok || rename(tmpPath, path) == -1) {
+        unlink(tmpPath);
+        return;
+    }
+    history_load_index();
+}
+
+// First index in a sorted offset array whose text does not sort before the pattern
+size_t lower_bound_text(const uint32_t* items, size_t count, const char* (*text)(uint32_t), const char* pattern) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(text(items[mid]), pattern) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+const char* suffix_text(uint32_t offset) {
+    return history.map + offset;
+}
+
+// Index of the record holding a byte offset of the log
+size_t record_of_offset(uint32_t offset) {
+    const uint32_t* records = history.indexRecords;
+    size_t count = history.indexRecordCount;
+    size_t base = 0;
+    if (offset >= history.indexLogSize) {
+        records = history.records;
+        count = history.recordCount;
+        base = history.indexRecordCount;
+    }
+    size_t lo = 0, hi = count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (records[mid] <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return base + lo;
+}
+
+void print_history_record(size_t index) {
+    HistoryRecord record;
+    uint32_t offset = history_record(index);
+    memcpy(&record, history.map + offset, sizeof(record));
+    time_t seconds = (time_t)(record.timestamp / 1000000000);
+    struct tm tm;
+    char when[32];
+    localtime_r(&seconds, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+    if (record.status == -1)
+        printf("%5zu  %s  %8s  %9s  %s\n", index + 1, when, "bg", "-", history_line(offset));
+    else
+        printf("%5zu  %s  %8d  %7.3fs  %s\n", index + 1, when, record.status,
+               record.duration / 1e9, history_line(offset));
+}
+
+int compare_size(const void* a, const void* b) {
+    size_t x = *(const size_t*)a, y = *(const size_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Prints the records whose lines start with (prefix) or contain (substring) the pattern
+void history_search(const char* pattern, int substring) {
+    size_t patternLen = strlen(pattern);
+    size_t* hits = NULL;
+    size_t hitCount = 0, hitCap = 0;
+    const uint32_t* items[2];
+    size_t count[2];
+    const char* (*text)(uint32_t);
+    if (substring) {
+        history_update_suffixes();
+        items[0] = history.indexSuffixes;
+        count[0] = history.indexSuffixCount;
+        items[1] = history.suffixes;
+        count[1] = history.suffixCount;
+        text = suffix_text;
+    } else {
+        history_update_sorted();
+        items[0] = history.indexSorted;
+        count[0] = history.indexRecordCount;
+        items[1] = history.sorted;
+        count[1] = history.sortedCount;
+        text = history_line;
+    }
+
+    // Matches form one contiguous run in the sorted order of the index and of the tail
+    for (int part = 0; part < 2; part++) {
+        size_t first = lower_bound_text(items[part], count[part], text, pattern);
+        size_t last = first;
+        while (last < count[part] && strncmp(text(items[part][last]), pattern, patternLen) == 0)
+            last++;
+        if (hitCount + (last - first) > hitCap) {
+            hitCap = hitCount + (last - first);
+            hits = (size_t*)realloc(hits, hitCap * sizeof(size_t));
+            if (hits == NULL) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (size_t i = first; i < last; i++)
+            hits[hitCount++] = record_of_offset(items[part][i]);
+    }
+
+    // Report each matching record once, oldest first
+    qsort(hits, hitCount, sizeof(size_t), compare_size);
+    for (size_t i = 0; i < hitCount; i++) {
+        if (i == 0 || hits[i] != hits[i - 1])
+            print_history_record(hits[i]);
+    }
+    free(hits);
+}
+
+// Handles the history builtin: history [N] | history -p PREFIX | history -s TEXT
+int handle_history(char** arr, int count) {
+    if (!history_refresh()) {
+        return count == 1 ? 1 : 0;
+    }
+    if (count == 3 && (strcmp(arr[1], "-s") == 0 || strcmp(arr[1], "-p") == 0)) {
+        history_merge_tail();
+        history_search(arr[2], arr[1][1] == 's');
+        return 1;
+    }
+    if (count > 2 || (count == 2 && atoi(arr[1]) <= 0)) {
+        fprintf(stderr, "ERR\n");
+        return 0;
+    }
+    size_t total = history_count();
+    size_t first = 0;
+    if (count == 2 && (size_t)atoi(arr[1]) < total)
+        first = total - (size_t)atoi(arr[1]);
+    for (size_t i = first; i < total; i++)
+        print_history_record(i);
+    return 1;
+}
+
+// Command-name completion. PATH executables are kept per directory and
+// merged into one sorted array; a background thread builds it on first use
+// and rescans only the directories whose mtime changed.
+typedef struct CompletionDir {
+    char* path;
+    struct timespec mtime;
+    dev_t dev;
+    ino_t ino;
+    char** names;   // sorted executable names
+    int count;
+} CompletionDir;
+
+typedef struct CompletionIndex {
+    char* pathValue;       // $PATH the directories were taken from
+    CompletionDir* dirs;
+    int dirCount;
+    char** names;          // merged, sorted, unique; points into the dirs
+    int count;
+} CompletionIndex;
+
+const char* builtinNames[] = {
+    "affinity", "alias", "capture", "checkpoint", "complete", "exit_shell", "export", "history", "iostat", "jobs", "limit",
+    "memstats", "shopt", "source", "trace", "unalias", "unset", "wait"
+};
+#define BUILTIN_COUNT ((int)(sizeof(builtinNames) / sizeof(builtinNames[0])))
+
+pthread_mutex_t completionLock = PTHREAD_MUTEX_INITIALIZER;
+CompletionIndex* completionIndex = NULL;   // current index, swapped under completionLock
+int completionBuilding = 0;                // a builder thread is running
+
+// Sorted alias names, rebuilt when aliasGeneration moves
+char** aliasNames = NULL;
+int aliasNameCount = 0;
+unsigned long aliasNamesGeneration = (unsigned long)-1;
+
+int compare_strings(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Lists the executables of one PATH directory, sorted
+void scan_completion_dir(CompletionDir* dir) {
+    int cap = 64;
+    dir->count = 0;
+    dir->names = (char**)malloc(cap * sizeof(char*));
+    if (dir->names == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    DIR* handle = opendir(dir->path);
+    if (handle == NULL)
+        return;
+    int dirFd = dirfd(handle);
+    struct dirent* entry;
+    while ((entry = readdir(handle)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+        if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN)
+            continue;
+        struct stat st;
+        if (fstatat(dirFd, entry->d_name, &st, 0) == -1 || !S_ISREG(st.st_mode) || !(st.st_mode & 0111))
+            continue;
+        if (dir->count == cap) {
+            cap *= 2;
+            dir->names = (char**)realloc(dir->names, cap * sizeof(char*));
+            if (dir->names == NULL) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        dir->names[dir->count] = strdup(entry->d_name);
+        if (dir->names[dir->count] == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        dir->count++;
+    }
+    closedir(handle);
+    qsort(dir->names, dir->count, sizeof(char*), compare_strings);
+}
+
+// Builds a new index for pathValue, reusing the directories of old that did not change
+CompletionIndex* build_completion_index(const char* pathValue, CompletionIndex* old) {
+    CompletionIndex* index = (CompletionIndex*)calloc(1, sizeof(CompletionIndex));
+    char* copy = strdup(pathValue);
+    if (index == NULL || copy == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    index->pathValue = strdup(pathValue);
+    int cap = 8;
+    index->dirs = (CompletionDir*)malloc(cap * sizeof(CompletionDir));
+    if (index->pathValue == NULL || index->dirs == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    int total = 0;
+    char* save = NULL;
+    for (char* part = strtok_r(copy, ":", &save); part != NULL; part = strtok_r(NULL, ":", &save)) {
+        struct stat st;
+        if (stat(part, &st) == -1 || !S_ISDIR(st.st_mode))
+            continue;
+        if (index->dirCount == cap) {
+            cap *= 2;
+            index->dirs = (CompletionDir*)realloc(index->dirs, cap * sizeof(CompletionDir));
+            if (index->dirs == NULL) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        CompletionDir* dir = &index->dirs[index->dirCount++];
+        dir->names = NULL;
+        dir->count = 0;
+
+        // An unchanged directory moves over from the old index without a rescan
+        for (int i = 0; old != NULL && i < old->dirCount; i++) {
+            CompletionDir* prev = &old->dirs[i];
+            if (prev->names != NULL && strcmp(prev->path, part) == 0 && prev->dev == st.st_dev &&
+                prev->ino == st.st_ino && prev->mtime.tv_sec == st.st_mtim.tv_sec &&
+                prev->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+                *dir = *prev;
+                prev->names = NULL;
+                prev->path = NULL;
+                break;
+            }
+        }
+        if (dir->names == NULL) {
+            dir->path = strdup(part);
+            if (dir->path == NULL) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+            dir->dev = st.st_dev;
+            dir->ino = st.st_ino;
+            dir->mtime = st.st_mtim;
+            scan_completion_dir(dir);
+        }
+        total += dir->count;
+    }
+    free(copy);
+
+    // Merge the per-directory lists and drop duplicates
+    index->names = (char**)malloc((total + 1) * sizeof(char*));
+    if (index->names == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < index->dirCount; i++) {
+        memcpy(index->names + index->count, index->dirs[i].names, index->dirs[i].count * sizeof(char*));
+        index->count += index->dirs[i].count;
+    }
+    qsort(index->names, index->count, sizeof(char*), compare_strings);
+    int unique = 0;
+    for (int i = 0; i < index->count; i++) {
+        if (unique == 0 || strcmp(index->names[unique - 1], index->names[i]) != 0)
+            index->names[unique++] = index->names[i];
+    }
+    index->count = unique;
+    return index;
+}
+
+// Frees an index; directories moved to a newer index were cleared and are skipped
+void free_completion_index(CompletionIndex* index) {
+    if (index == NULL)
+        return;
+    for (int i = 0; i < index->dirCount; i++) {
+        if (index->dirs[i].names != NULL) {
+            for (int j = 0; j < index->dirs[i].count; j++)
+                free(index->dirs[i].names[j]);
+            free(index->dirs[i].names);
+        }
+        free(index->dirs[i].path);
+    }
+    free(index->dirs);
+    free(index->names);
+    free(index->pathValue);
+    free(index);
+}
+
+void* completion_builder(void* arg) {
+    char* pathValue = (char*)arg;
+    // Only this thread creates indexes, so reading the current one unlocked is safe
+    CompletionIndex* old = completionIndex;
+    CompletionIndex* index = build_completion_index(pathValue, old);
+    free(pathValue);
+
+    pthread_mutex_lock(&completionLock);
+    completionIndex = index;
+    completionBuilding = 0;
+    pthread_mutex_unlock(&completionLock);
+    free_completion_index(old);
+    return NULL;
+}
+
+// Returns 1 if the index is missing or a PATH directory changed since it was built
+int completion_stale(const CompletionIndex* index, const char* pathValue) {
+    if (index == NULL || strcmp(index->pathValue, pathValue) != 0)
+        return 1;
+    for (int i = 0; i < index->dirCount; i++) {
+        struct stat st;
+        if (stat(index->dirs[i].path, &st) == -1 || st.st_mtim.tv_sec != index->dirs[i].mtime.tv_sec ||
+            st.st_mtim.tv_nsec != index->dirs[i].mtime.tv_nsec || st.st_ino != index->dirs[i].ino)
+            return 1;
+    }
+    return 0;
+}
+
+// Starts a background (re)build if the index is stale; wait == 1 blocks until one exists
+void refresh_completion(int wait) {
+    const char* pathValue = getenv("PATH");
+    if (pathValue == NULL)
+        pathValue = "";
+
+    pthread_mutex_lock(&completionLock);
+    int start = !completionBuilding && completion_stale(completionIndex, pathValue);
+    if (start)
+        completionBuilding = 1;
+    pthread_mutex_unlock(&completionLock);
+
+    if (start) {
+        char* arg = strdup(pathValue);
+        if (arg == NULL || !start_helper_thread(completion_builder, arg)) {
+            free(arg);
+            pthread_mutex_lock(&completionLock);
+            completionBuilding = 0;
+            pthread_mutex_unlock(&completionLock);
+            return;
+        }
+    }
+
+    while (wait) {
+        pthread_mutex_lock(&completionLock);
+        int ready = completionIndex != NULL || !completionBuilding;
+        pthread_mutex_unlock(&completionLock);
+        if (ready)
+            break;
+        struct timespec ts = { 0, 1000000 };
+        nanosleep(&ts, NULL);
+    }
+}
+
+// Rebuilds the sorted alias-name array when the alias table changed
+void refresh_alias_names(const Dictionary* dict) {
+    alias_shm_sync();
+    if (aliasNamesGeneration == aliasGeneration && aliasNames != NULL)
+        return;
+    free(aliasNames);
+    if (aliasShm != NULL) {
+        // Names of the shared segment come from a private copy
+        static Dictionary shared;
+        if (shared.buckets != NULL)
+            freeDictionary(&shared);
+        initDictionary(&shared);
+        shm_foreach(aliasShm, export_alias, &shared);
+        dict = &shared;
+    }
+    aliasNames = (char**)malloc((dict->count + 1) * sizeof(char*));
+    if (aliasNames == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    aliasNameCount = 0;
+    for (Node* current = dict->head; current != NULL; current = current->next)
+        aliasNames[aliasNameCount++] = (char*)current->key;
+    qsort(aliasNames, aliasNameCount, sizeof(char*), compare_strings);
+    aliasNamesGeneration = aliasGeneration;
+}
+
+// Appends the names of a sorted array that start with prefix
+void collect_prefix(char* const* names, int count, const char* prefix, char*** out, int* outCount, int* outCap) {
+    size_t len = strlen(prefix);
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strcmp(names[mid], prefix) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (int i = lo; i < count && strncmp(names[i], prefix, len) == 0; i++) {
+        if (*outCount == *outCap) {
+            *outCap = *outCap ? *outCap * 2 : 16;
+            *out = (char**)realloc(*out, *outCap * sizeof(char*));
+            if (*out == NULL) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        (*out)[(*outCount)++] = strdup(names[i]);
+    }
+}
+
+// Returns the sorted, unique command names (aliases, builtins, PATH) starting with prefix.
+// The caller frees the result with free_split_string.
+char** complete_command(const Dictionary* dict, const char* prefix, int* count) {
+    char** matches = NULL;
+    int matchCount = 0, matchCap = 0;
+
+    refresh_completion(1);
+    refresh_alias_names(dict);
+    collect_prefix(aliasNames, aliasNameCount, prefix, &matches, &matchCount, &matchCap);
+    collect_prefix((char* const*)builtinNames, BUILTIN_COUNT, prefix, &matches, &matchCount, &matchCap);
+    pthread_mutex_lock(&completionLock);
+    if (completionIndex != NULL)
+        collect_prefix(completionIndex->names, completionIndex->count, prefix, &matches, &matchCount, &matchCap);
+    pthread_mutex_unlock(&completionLock);
+
+    qsort(matches, matchCount, sizeof(char*), compare_strings);
+    int unique = 0;
+    for (int i = 0; i < matchCount; i++) {
+        if (unique > 0 && strcmp(matches[unique - 1], matches[i]) == 0)
+            free(matches[i]);
+        else
+            matches[unique++] = matches[i];
+    }
+    matches = (char**)realloc(matches, (unique + 1) * sizeof(char*));
+    if (matches == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    matches[unique] = NULL;
+    *count = unique;
+    return matches;
+}
+
+// Interactive line editor: termios raw mode, emacs-style keys, history and
+// Tab completion. Each refresh rewrites only the part of the line that
+// changed and is sent with one writev.
+#define EDITOR_MAX 1024
+#define EDITOR_HISTORY_MAX 1000
+
+void io_flush_output();
+
+typedef struct LineEditor {
+    char buf[EDITOR_MAX];
+    int len, pos;
+    char shown[EDITOR_MAX];   // what the terminal currently shows after the prompt
+    int shownLen, shownPos;
+    const char* prompt;
+} LineEditor;
+
+char editorYank[EDITOR_MAX] = "";
+char* editorHistory[EDITOR_HISTORY_MAX];
+int editorHistoryCount = 0;
+int editorHistoryLoaded = 0;
+
+// Remembers an entered line for Up/Down navigation
+void editor_history_add(const char* line) {
+    if (line[0] == '\0')
+        return;
+    if (editorHistoryCount > 0 && strcmp(editorHistory[editorHistoryCount - 1], line) == 0)
+        return;
+    if (editorHistoryCount == EDITOR_HISTORY_MAX) {
+        free(editorHistory[0]);
+        memmove(editorHistory, editorHistory + 1, (EDITOR_HISTORY_MAX - 1) * sizeof(char*));
+        editorHistoryCount--;
+    }
+    editorHistory[editorHistoryCount] = strdup(line);
+    if (editorHistory[editorHistoryCount] != NULL)
+        editorHistoryCount++;
+}
+
+// Seeds the navigation list with the tail of the history log
+void editor_history_load() {
+    if (editorHistoryLoaded)
+        return;
+    editorHistoryLoaded = 1;
+    if (!history_refresh())
+        return;
+    size_t total = history_count();
+    size_t first = total > EDITOR_HISTORY_MAX ? total - EDITOR_HISTORY_MAX : 0;
+    for (size_t i = first; i < total; i++)
+        editor_history_add(history_line(history_record(i)));
+}
+
+// Collects escape sequences for one refresh so they go out in the same writev
+typedef struct EditorOutput {
+    struct iovec iov[8];
+    int count;
+    char scratch[128];
+    int used;
+} EditorOutput;
+
+void out_text(EditorOutput* out, const char* text, size_t len) {
+    if (len == 0 || out->count == 8)
+        return;
+    out->iov[out->count].iov_base = (void*)text;
+    out->iov[out->count].iov_len = len;
+    out->count++;
+}
+
+void out_seq(EditorOutput* out, const char* format, int n) {
+    int room = (int)sizeof(out->scratch) - out->used;
+    int len = snprintf(out->scratch + out->used, room, format, n);
+    if (len <= 0 || len >= room)
+        return;
+    out_text(out, out->scratch + out->used, len);
+    out->used += len;
+}
+
+// Moves the cursor horizontally by delta columns
+void out_move(EditorOutput* out, int delta) {
+    if (delta < 0)
+        out_seq(out, "\x1b[%dD", -delta);
+    else if (delta > 0)
+        out_seq(out, "\x1b[%dC", delta);
+}
+
+void out_flush(EditorOutput* out) {
+    struct iovec* iov = out->iov;
+    int count = out->count;
+    while (count > 0) {
+        ssize_t n = writev(STDOUT_FILENO, iov, count);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+// Brings the terminal in line with the buffer, rewriting only from the first changed byte
+void editor_refresh(LineEditor* ed) {
+    EditorOutput out = { .count = 0, .used = 0 };
+    int common = 0;
+    while (common < ed->len && common < ed->shownLen && ed->buf[common] == ed->shown[common])
+        common++;
+
+    if (common == ed->len && common == ed->shownLen) {
+        out_move(&out, ed->pos - ed->shownPos);
+    } else {
+        out_move(&out, common - ed->shownPos);
+        out_text(&out, ed->buf + common, ed->len - common);
+        if (ed->shownLen > ed->len)
+            out_seq(&out, "\x1b[K", 0);
+        out_move(&out, ed->pos - ed->len);
+    }
+    out_flush(&out);
+
+    memcpy(ed->shown, ed->buf, ed->len);
+    ed->shownLen = ed->len;
+    ed->shownPos = ed->pos;
+}
+
+// Redraws prompt and line from the start of the row
+void editor_redraw(LineEditor* ed, int clearScreen) {
+    EditorOutput out = { .count = 0, .used = 0 };
+    out_text(&out, clearScreen ? "\x1b[H\x1b[2J" : "\r", clearScreen ? 7 : 1);
+    out_text(&out, ed->prompt, strlen(ed->prompt));
+    out_text(&out, ed->buf, ed->len);
+    out_seq(&out, "\x1b[K", 0);
+    out_move(&out, ed->pos - ed->len);
+    out_flush(&out);
+    memcpy(ed->shown, ed->buf, ed->len);
+    ed->shownLen = ed->len;
+    ed->shownPos = ed->pos;
+}
+
+void editor_insert(LineEditor* ed, const char* text, int len) {
+    if (ed->len + len >= EDITOR_MAX)
+        len = EDITOR_MAX - 1 - ed->len;
+    if (len <= 0)
+        return;
+    memmove(ed->buf + ed->pos + len, ed->buf + ed->pos, ed->len - ed->pos);
+    memcpy(ed->buf + ed->pos, text, len);
+    ed->len += len;
+    ed->pos += len;
+}
+
+// Deletes [from, to) and optionally keeps it for Ctrl-Y
+void editor_kill(LineEditor* ed, int from, int to, int keep) {
+    if (to <= from)
+        return;
+    if (keep) {
+        memcpy(editorYank, ed->buf + from, to - from);
+        editorYank[to - from] = '\0';
+    }
+    memmove(ed->buf + from, ed->buf + to, ed->len - to);
+    ed->len -= to - from;
+    ed->pos = from;
+}
+
+void editor_set(LineEditor* ed, const char* text) {
+    ed->len = (int)strlen(text);
+    if (ed->len >= EDITOR_MAX)
+        ed->len = EDITOR_MAX - 1;
+    memcpy(ed->buf, text, ed->len);
+    ed->pos = ed->len;
+}
+
+// Tab: completes the command word under the cursor; a second Tab lists the candidates
+void editor_complete(LineEditor* ed, const Dictionary* dict, int repeated) {
+    int start = ed->pos;
+    while (start > 0 && ed->buf[start - 1] != ' ')
+        start--;
+    for (int i = 0; i < start; i++) {
+        if (ed->buf[i] != ' ')
+            return;  // only the first word names a command
+    }
+
+    char prefix[EDITOR_MAX];
+    memcpy(prefix, ed->buf + start, ed->pos - start);
+    prefix[ed->pos - start] = '\0';
+    int count;
+    char** matches = complete_command(dict, prefix, &count);
+    if (count == 1) {
+        editor_insert(ed, matches[0] + strlen(prefix), (int)strlen(matches[0] + strlen(prefix)));
+        editor_insert(ed, " ", 1);
+    } else if (count > 1) {
+        // Extend to the longest common prefix of the candidates
+        size_t common = strlen(matches[0]);
+        for (int i = 1; i < count; i++) {
+            size_t j = 0;
+            while (j < common && matches[i][j] == matches[0][j])
+                j++;
+            common = j;
+        }
+        if (common > strlen(prefix)) {
+            editor_insert(ed, matches[0] + strlen(prefix), (int)(common - strlen(prefix)));
+        } else if (repeated) {
+            printf("\r\n");
+            for (int i = 0; i < count && i < 200; i++)
+                printf("%s%s", matches[i], (i + 1) % 6 == 0 ? "\r\n" : "  ");
+            if (count > 200)
+                printf("... (%d more)", count - 200);
+            printf("\r\n");
+            io_flush_output();
+            editor_redraw(ed, 0);
+        }
+    }
+    free_split_string(matches);
+}
+
+// Reads one line with editing; returns 0 on end of input. The line is stored without '\n'.
+int editor_read_line(const char* prompt, char* line, size_t size, const Dictionary* dict) {
+    struct termios cooked, raw;
+    if (tcgetattr(STDIN_FILENO, &cooked) == -1)
+        return -1;
+    raw = cooked;
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_iflag &= ~(IXON | ICRNL | BRKINT | INPCK | ISTRIP);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1)
+        return -1;
+
+    editor_history_load();
+    LineEditor ed = { .len = 0, .pos = 0, .shownLen = 0, .shownPos = 0, .prompt = prompt };
+    char saved[EDITOR_MAX] = "";     // the new line while browsing history
+    int historyPos = editorHistoryCount;
+    int lastKey = 0;
+    int result = 1;
+
+    io_flush_output();
+    editor_redraw(&ed, 0);
+    while (1) {
+        unsigned char c;
+        ssize_t n = read(STDIN_FILENO, &c, 1);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            result = 0;
+            break;
+        }
+
+        int key = c;
+        if (c == 27) {
+            // Escape sequences for arrows, Home, End and Delete
+            unsigned char seq[3];
+            if (read(STDIN_FILENO, &seq[0], 1) != 1 || read(STDIN_FILENO, &seq[1], 1) != 1)
+                continue;
+            if (seq[0] == '[' && seq[1] >= '0' && seq[1] <= '9') {
+                if (read(STDIN_FILENO, &seq[2], 1) != 1)
+                    continue;
+                key = seq[1] == '3' ? 4 : seq[1] == '1' || seq[1] == '7' ? 1 : seq[1] == '4' || seq[1] == '8' ? 5 : 0;
+                if (seq[1] == '3' && ed.len == 0)
+                    key = 0;  // Delete on an empty line is not end of input
+            } else if (seq[0] == '[' || seq[0] == 'O') {
+                switch (seq[1]) {
+                    case 'A': key = 16; break;  // Up    -> Ctrl-P
+                    case 'B': key = 14; break;  // Down  -> Ctrl-N
+                    case 'C': key = 6; break;   // Right -> Ctrl-F
+                    case 'D': key = 2; break;   // Left  -> Ctrl-B
+                    case 'H': key = 1; break;   // Home  -> Ctrl-A
+                    case 'F': key = 5; break;   // End   -> Ctrl-E
+                    default: key = 0;
+                }
+            } else {
+                key = 0;
+            }
+        }
+
+        if (key == '\r' || key == '\n') {
+            break;
+        } else if (key == 3) {            // Ctrl-C: drop the line
+            ed.len = ed.pos = 0;
+            printf("^C\r\n");
+            io_flush_output();
+            editor_redraw(&ed, 0);
+            historyPos = editorHistoryCount;
+        } else if (key == 4) {            // Ctrl-D: delete, or end of input on an empty line
+            if (ed.len == 0) {
+                result = 0;
+                break;
+            }
+            if (ed.pos < ed.len)
+                editor_kill(&ed, ed.pos, ed.pos + 1, 0);
+        } else if (key == 127 || key == 8) {
+            if (ed.pos > 0)
+                editor_kill(&ed, ed.pos - 1, ed.pos, 0);
+        } else if (key == 1) {
+            ed.pos = 0;
+        } else if (key == 5) {
+            ed.pos = ed.len;
+        } else if (key == 2) {
+            if (ed.pos > 0)
+                ed.pos--;
+        } else if (key == 6) {
+            if (ed.pos < ed.len)
+                ed.pos++;
+        } else if (key == 11) {           // Ctrl-K: kill to end of line
+            editor_kill(&ed, ed.pos, ed.len, 1);
+        } else if (key == 21) {           // Ctrl-U: kill to start of line
+            editor_kill(&ed, 0, ed.pos, 1);
+        } else if (key == 23) {           // Ctrl-W: kill the previous word
+            int start = ed.pos;
+            while (start > 0 && ed.buf[start - 1] == ' ')
+                start--;
+            while (start > 0 && ed.buf[start - 1] != ' ')
+                start--;
+            editor_kill(&ed, start, ed.pos, 1);
+        } else if (key == 25) {           // Ctrl-Y: yank
+            editor_insert(&ed, editorYank, (int)strlen(editorYank));
+        } else if (key == 16 || key == 14) {
+            if (key == 16 && historyPos > 0) {
+                if (historyPos == editorHistoryCount) {
+                    memcpy(saved, ed.buf, ed.len);
+                    saved[ed.len] = '\0';
+                }
+                editor_set(&ed, editorHistory[--historyPos]);
+            } else if (key == 14 && historyPos < editorHistoryCount) {
+                historyPos++;
+                editor_set(&ed, historyPos == editorHistoryCount ? saved : editorHistory[historyPos]);
+            }
+        } else if (key == 9) {
+            editor_complete(&ed, dict, lastKey == 9);
+        } else if (key == 12) {           // Ctrl-L: clear screen
+            editor_redraw(&ed, 1);
+        } else if (key >= 32 && key < 127) {
+            char ch = (char)key;
+            editor_insert(&ed, &ch, 1);
+        }
+        lastKey = key;
+        editor_refresh(&ed);
+    }
+
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &cooked);
+    if (write(STDOUT_FILENO, "\n", 1) == -1)
+        result = 0;
+    if (result == 0)
+        return 0;
+
+    size_t len = (size_t)ed.len < size - 1 ? (size_t)ed.len : size - 1;
+    memcpy(line, ed.buf, len);
+    line[len] = '\0';
+    editor_history_add(line);
+    return 1;
+}
+
+//Global Var for Succeeded command
+int succeededCMD = 0;
+// Exit status of the last command (128+signal when killed, -1 for a background launch)
+int lastExitStatus = 0;
+
+// Converts a waitpid status into a shell exit status
+// Ledger status of a re-adopted job, whose exit status cannot be collected
+#define STATUS_UNKNOWN (-1)
+
+int decode_status(int status) {
+    if (status == STATUS_UNKNOWN)
+        return 127;   // never reported as success
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return 1;
+}
+char** split_string(const char *str, int *count);
+void free_split_string(char **str_array);
+int checkForAlias(char* input, Dictionary* dict);
+
+void execute_source_script(const char* filename, Dictionary* dict, int* scriptLine, int* aposCounter);
+void execute_profiled_script(char** arr, int count, Dictionary* dict, int* scriptLine, int* aposCounter);
+void execute_general(char* input ,Dictionary* dict, int *aposCounter);
+int findEndFile (const char* filename);
+int check_logic_op(char** arr);
+void execute_logical_operator(char** arr, Dictionary* dict , int count, int* aposCounter);
+char* separate_command(char** arr , int* counter_per_command);
+char* check_redirect(char** arr, int count);
+void redirect_stderr (const char* fileName, int* prevDupVal);
+char* separate_befor_2arrow(char** arr);
+int is_compound(const char* line);
+int run_list(const char* text, Dictionary* dict, int* aposCounter);
+
+// Ledger of recently completed background jobs. Entries are written from
+// the SIGCHLD handler into a fixed ring, so recording never allocates.
+#define LEDGER_SIZE 256
+
+typedef struct LedgerEntry {
+    int job_id;
+    pid_t pid;
+    char command[128];
+    int status;          // raw wait status
+    int64_t startTime;   // nanoseconds since the epoch
+    int64_t startClock;  // CLOCK_MONOTONIC at launch
+    int64_t wallNs;
+    struct rusage usage;
+} LedgerEntry;
+
+LedgerEntry ledger[LEDGER_SIZE];
+unsigned long ledgerCount = 0;   // entries ever recorded; the ring keeps the last LEDGER_SIZE
+
+void ledger_record(const Job* job, int status, const struct rusage* usage) {
+    LedgerEntry* entry = &ledger[ledgerCount % LEDGER_SIZE];
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    entry->job_id = job->job_id;
+    entry->pid = job->pid;
+    strncpy(entry->command, job->command, sizeof(entry->command) - 1);
+    entry->command[sizeof(entry->command) - 1] = '\0';
+    entry->status = status;
+    entry->startTime = job->startTime;
+    entry->startClock = job->startClock;
+    entry->wallNs = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec - job->startClock;
+    if (usage != NULL)
+        entry->usage = *usage;
+    else
+        memset(&entry->usage, 0, sizeof(entry->usage));
+    ledgerCount++;
+}
+
+// Most recent ledger entry for a pid or a job id, or NULL
+const LedgerEntry* ledger_find(pid_t pid, int job_id) {
+    unsigned long first = ledgerCount > LEDGER_SIZE ? ledgerCount - LEDGER_SIZE : 0;
+    for (unsigned long i = ledgerCount; i > first; i--) {
+        const LedgerEntry* entry = &ledger[(i - 1) % LEDGER_SIZE];
+        if ((pid > 0 && entry->pid == pid) || (job_id > 0 && entry->job_id == job_id))
+            return entry;
+    }
+    return NULL;
+}
+
+double timeval_seconds(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// "exit N" or "signal N" for a wait status
+void describe_status(int status, char* out, size_t size) {
+    if (status == STATUS_UNKNOWN)
+        snprintf(out, size, "unknown");
+    else if (WIFSIGNALED(status))
+        snprintf(out, size, "signal %d", WTERMSIG(status));
+    else
+        snprintf(out, size, "exit %d", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+}
+
+// Writes a string as a JSON string literal
+void json_string(FILE* out, const char* text) {
+    fputc('"', out);
+    for (const unsigned char* ptr = (const unsigned char*)text; *ptr; ptr++) {
+        if (*ptr == '"' || *ptr == '\\')
+            fprintf(out, "\\%c", *ptr);
+        else if (*ptr < 0x20)
+            fprintf(out, "\\u%04x", *ptr);
+        else
+            fputc(*ptr, out);
+    }
+    fputc('"', out);
+}
+
+// jobs -c [--json [FILE]]: completed jobs, oldest first
+int print_ledger(char** arr, int count) {
+    int json = count >= 3 && strcmp(arr[2], "--json") == 0;
+    if (count > 4 || (count >= 3 && !json)) {
+        fprintf(stderr, "ERR\n");
+        return 0;
+    }
+
+    // Copy the ring with SIGCHLD blocked so the handler cannot overwrite it midway
+    sigset_t block, prev;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &prev);
+    unsigned long total = ledgerCount;
+    unsigned long first = total > LEDGER_SIZE ? total - LEDGER_SIZE : 0;
+    int n = (int)(total - first);
+    LedgerEntry* entries = (LedgerEntry*)malloc((n + 1) * sizeof(LedgerEntry));
+    if (entries == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < n; i++)
+        entries[i] = ledger[(first + i) % LEDGER_SIZE];
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+
+    if (!json) {
+        char status[32];
+        for (int i = 0; i < n; i++) {
+            describe_status(entries[i].status, status, sizeof(status));
+            printf("[%d] %d %-10s wall %.3fs user %.3fs sys %.3fs maxrss %ldK  %s\n", entries[i].job_id,
+                   entries[i].pid, status, entries[i].wallNs / 1e9, timeval_seconds(entries[i].usage.ru_utime),
+                   timeval_seconds(entries[i].usage.ru_stime), entries[i].usage.ru_maxrss, entries[i].command);
+        }
+        free(entries);
+        return 1;
+    }
+
+    FILE* out = stdout;
+    if (count == 4) {
+        out = fopen(arr[3], "w");
+        if (out == NULL) {
+            perror(arr[3]);
+            free(entries);
+            return 0;
+        }
+    }
+    fprintf(out, "[");
+    for (int i = 0; i < n; i++) {
+        LedgerEntry* e = &entries[i];
+        fprintf(out, "%s\n  {\"job\": %d, \"pid\": %d, \"command\": ", i ? "," : "", e->job_id, e->pid);
+        json_string(out, e->command);
+        if (e->status == STATUS_UNKNOWN)
+            fprintf(out, ", \"exit\": null, \"signal\": null");
+        else if (WIFSIGNALED(e->status))
+            fprintf(out, ", \"exit\": null, \"signal\": %d", WTERMSIG(e->status));
+        else
+            fprintf(out, ", \"exit\": %d, \"signal\": null", WEXITSTATUS(e->status));
+        fprintf(out, ", \"start\": %.6f, \"wall\": %.6f, \"user\": %.6f, \"sys\": %.6f, \"maxrss_kb\": %ld}",
+                e->startTime / 1e9, e->wallNs / 1e9, timeval_seconds(e->usage.ru_utime),
+                timeval_seconds(e->usage.ru_stime), e->usage.ru_maxrss);
+    }
+    fprintf(out, "%s]\n", n ? "\n" : "");
+    if (out != stdout)
+        fclose(out);
+    free(entries);
+    return 1;
+}
+
+// Chrome trace-event export (trace on FILE). Spans are written as complete
+// ("X") events; with tracing off every probe is a single NULL check.
+FILE* traceOut = NULL;
+int64_t traceBase = 0;           // CLOCK_MONOTONIC at trace on
+unsigned long traceLedger = 0;   // ledger entries already written as job spans
+unsigned long traceEvents = 0;
+
+// Start of a span, or 0 while tracing is off
+int64_t trace_now() {
+    return traceOut != NULL ? now_ns(CLOCK_MONOTONIC) : 0;
+}
+
+// Writes a span from start until now on the given track (0 = the shell itself)
+void trace_span_at(const char* name, int64_t start, int64_t end, int tid, const char* detail) {
+    fprintf(traceOut, "{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d",
+            name, (start - traceBase) / 1e3, (end - start) / 1e3, (int)getpid(), tid);
+    if (detail != NULL) {
+        fprintf(traceOut, ", \"args\": {\"cmd\": ");
+        json_string(traceOut, detail);
+        fprintf(traceOut, "}");
+    }
+    fprintf(traceOut, "},\n");
+    traceEvents++;
+}
+
+void trace_span(const char* name, int64_t start, const char* detail) {
+    if (traceOut != NULL && start != 0)
+        trace_span_at(name, start, now_ns(CLOCK_MONOTONIC), 0, detail);
+}
+
+// Names a track in the viewer
+void trace_track(int tid, const char* name) {
+    fprintf(traceOut, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": ",
+            (int)getpid(), tid);
+    json_string(traceOut, name);
+    fprintf(traceOut, "}},\n");
+}
+
+// Background jobs finished since the last call, each on a track of its own
+void trace_jobs() {
+    if (traceOut == NULL || traceLedger == ledgerCount)
+        return;
+    sigset_t block, prev;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &prev);
+    if (ledgerCount - traceLedger > LEDGER_SIZE)
+        traceLedger = ledgerCount - LEDGER_SIZE;
+    for (; traceLedger < ledgerCount; traceLedger++) {
+        const LedgerEntry* entry = &ledger[traceLedger % LEDGER_SIZE];
+        if (entry->startClock < traceBase)
+            continue;
+        char name[160];
+        snprintf(name, sizeof(name), "job [%d] %d", entry->job_id, entry->pid);
+        trace_track(entry->pid, name);
+        trace_span_at("job", entry->startClock, entry->startClock + entry->wallNs, entry->pid, entry->command);
+    }
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+void trace_stop() {
+    if (traceOut == NULL)
+        return;
+    trace_jobs();
+    trace_track(0, "minishell");
+    fprintf(traceOut, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"minishell\"}}\n]\n",
+            (int)getpid());
+    fclose(traceOut);
+    traceOut = NULL;
+}
+
+// trace on FILE | trace off | trace
+int handle_trace(char** arr, int count) {
+    if (count == 1) {
+        printf("trace %s (%lu events)\n", traceOut != NULL ? "on" : "off", traceEvents);
+        return 1;
+    }
+    if (count == 2 && strcmp(arr[1], "off") == 0) {
+        trace_stop();
+        return 1;
+    }
+    if (count != 3 || strcmp(arr[1], "on") != 0) {
+        fprintf(stderr, "ERR\n");
+        return 0;
+    }
+    trace_stop();
+    traceOut = fopen(arr[2], "we");
+    if (traceOut == NULL) {
+        perror(arr[2]);
+        return 0;
+    }
+    traceBase = now_ns(CLOCK_MONOTONIC);
+    traceLedger = ledgerCount;
+    traceEvents = 0;
+    fprintf(traceOut, "[\n");
+    return 1;
+}
+
+// Bookkeeping for a reaped background job: success count, limit report, ledger, job table
+void job_finished(pid_t pid, int status, const struct rusage* usage) {
+    for (Job* current = job_list; current != NULL; current = current->next) {
+        if (current->pid == pid) {
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+                succeededCMD++;
+            if (current->limited)
+                queue_limit_report(current, status);
+            ledger_record(current, status, usage);
+            break;
+        }
+    }
+    remove_job(pid);
+}
+
+void sigHandler(int sig) {
+    pid_t pid;
+    int status;
+    struct rusage usage;
+
+    while ((pid = wait4(-1, &status, WNOHANG, &usage)) > 0) {
+        job_finished(pid, status, &usage);
+    }
+}
+
+// Finds a job by pid or by its job id
+Job* find_job(pid_t pid, int job_id) {
+    for (Job* current = job_list; current != NULL; current = current->next) {
+        if ((pid > 0 && current->pid == pid) || (job_id > 0 && current->job_id == job_id))
+            return current;
+    }
+    return NULL;
+}
+
+int pidfd_open(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Session checkpoint: `checkpoint FILE` writes the counters, the background
+// jobs and the alias table to one file, and `--restore FILE` reads it back
+// in a single mmap pass. Jobs still running are tracked again: a job that is
+// still our child (the shell exec'ed itself) is reaped as usual, any other
+// one is re-adopted through a pidfd and polled, since only its exit and not
+// its status can be observed.
+#define CHECKPOINT_MAGIC "MSCP"
+#define CHECKPOINT_VERSION 1
+
+typedef struct CheckpointHeader {
+    char magic[4];
+    uint32_t version;
+    int32_t succeeded;
+    int32_t scriptLine;
+    int32_t aposCounter;
+    int32_t lastStatus;
+    int32_t nextJobId;
+    uint32_t jobCount;
+    uint32_t aliasCount;
+    uint32_t checksum;   // FNV-1a over the bytes after the header
+    uint64_t size;
+} CheckpointHeader;
+
+// Followed by commandLen bytes of command; the alias records come after the jobs
+typedef struct CheckpointJob {
+    int32_t jobId;
+    int32_t pid;
+    int64_t startTime;
+    uint64_t procStart;  // start time from /proc/<pid>/stat, to tell a reused pid apart
+    uint32_t commandLen;
+} CheckpointJob;
+
+// Start time of a process in clock ticks since boot, or 0 if it is gone
+uint64_t proc_start_time(pid_t pid) {
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return 0;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return 0;
+    buf[n] = '\0';
+    // The command name may hold spaces; count fields from its closing parenthesis
+    char* ptr = strrchr(buf, ')');
+    for (int field = 2; ptr != NULL && field < 22; field++)
+        ptr = strchr(ptr + 1, ' ');
+    return ptr != NULL ? strtoull(ptr + 1, NULL, 10) : 0;
+}
+
+// Records a re-adopted job whose pidfd reported its exit; SIGCHLD must be blocked
+void adopted_finished(Job* job) {
+    ledger_record(job, STATUS_UNKNOWN, NULL);
+    remove_job(job->pid);
+}
+
+// Checks the re-adopted jobs without blocking; called before each prompt
+void check_adopted() {
+    sigset_t block, prev;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &prev);
+    Job* current = job_list;
+    while (current != NULL) {
+        Job* next = current->next;
+        struct pollfd fd = { current->pidfd, POLLIN, 0 };
+        if (current->pidfd != -1 && poll(&fd, 1, 0) == 1)
+            adopted_finished(current);
+        current = next;
+    }
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+int* scriptLineCounter = NULL;   // main's script line count, saved by checkpoint
+
+// checkpoint FILE
+int handle_checkpoint(char** arr, int count, const Dictionary* dict, int scriptLine, int aposCounter) {
+    if (count != 2) {
+        fprintf(stderr, "ERR\n");
+        return 0;
+    }
+    // A shared alias segment is written from a private copy
+    Dictionary exported;
+    if (aliasShm != NULL) {
+        initDictionary(&exported);
+        shm_foreach(aliasShm, export_alias, &exported);
+        dict = &exported;
+    }
+
+    sigset_t block, prev;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &prev);
+    size_t size = alias_records_size(dict);
+    uint32_t jobCount = 0;
+    for (Job* current = job_list; current != NULL; current = current->next, jobCount++)
+        size += sizeof(CheckpointJob) + strlen(current->command);
+    unsigned char* buffer = (unsigned char*)malloc(sizeof(CheckpointHeader) + size);
+    if (buffer == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    unsigned char* ptr = buffer + sizeof(CheckpointHeader);
+    for (Job* current = job_list; current != NULL; current = current->next) {
+        CheckpointJob record;
+        memset(&record, 0, sizeof(record));   // no stack bytes in the padding
+        record.jobId = current->job_id;
+        record.pid = current->pid;
+        record.startTime = current->startTime;
+        record.procStart = proc_start_time(current->pid);
+        record.commandLen = (uint32_t)strlen(current->command);
+        memcpy(ptr, &record, sizeof(record));
+        memcpy(ptr + sizeof(record), current->command, record.commandLen);
+        ptr += sizeof(record) + record.commandLen;
+    }
+    CheckpointHeader header;
+    memcpy(header.magic, CHECKPOINT_MAGIC, 4);
+    header.version = CHECKPOINT_VERSION;
+    header.succeeded = succeededCMD;
+    header.scriptLine = scriptLine;
+    header.aposCounter = aposCounter;
+    header.lastStatus = lastExitStatus;
+    header.nextJobId = next_job_id;
+    header.jobCount = jobCount;
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+
+    pack_alias_records(dict, ptr);
+    header.aliasCount = (uint32_t)dict->count;
+    header.checksum = hashBytes(buffer + sizeof(header), size);
+    header.size = size;
+    memcpy(buffer, &header, sizeof(header));
+    int saved = replace_file(arr[1], buffer, sizeof(header) + size, "checkpoint");
+    free(buffer);
+    if (aliasShm != NULL)
+        freeDictionary(&exported);
+    return saved;
+}
+
+// --restore FILE: replaces the alias table and counters and tracks the jobs that still run
+int restore_checkpoint(const char* path, Dictionary* dict, int* scriptLine, int* aposCounter) {
+    int64_t started = now_ns(CLOCK_MONOTONIC);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror("restore");
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(CheckpointHeader)) {
+        close(fd);
+        return 0;
+    }
+    unsigned char* map = (unsigned char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+    CheckpointHeader header;
+    memcpy(&header, map, sizeof(header));
+    const unsigned char* ptr = map + sizeof(header);
+    const unsigned char* end = ptr + header.size;
+    if (memcmp(header.magic, CHECKPOINT_MAGIC, 4) != 0 || header.version != CHECKPOINT_VERSION ||
+        header.size != (uint64_t)st.st_size - sizeof(header) || hashBytes(ptr, header.size) != header.checksum) {
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    succeededCMD = header.succeeded;
+    *scriptLine = header.scriptLine;
+    *aposCounter = header.aposCounter;
+    lastExitStatus = header.lastStatus;
+
+    sigset_t block, prev;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &prev);
+    int running = 0, children = 0, maxId = 0;
+    int64_t realNow = now_ns(CLOCK_REALTIME), monoNow = now_ns(CLOCK_MONOTONIC);
+    char command[1024];
+    for (uint32_t i = 0; i < header.jobCount; i++) {
+        CheckpointJob record;
+        if ((size_t)(end - ptr) < sizeof(record))
+            break;
+        memcpy(&record, ptr, sizeof(record));
+        ptr += sizeof(record);
+        if ((size_t)(end - ptr) < record.commandLen)
+            break;
+        size_t len = record.commandLen < sizeof(command) ? record.commandLen : sizeof(command) - 1;
+        memcpy(command, ptr, len);
+        command[len] = '\0';
+        ptr += record.commandLen;
+        if (record.jobId > maxId)
+            maxId = record.jobId;
+        // A pid that is gone or now names another process ended while the shell was down
+        if (record.procStart == 0 || proc_start_time(record.pid) != record.procStart)
+            continue;
+        siginfo_t info;
+        info.si_pid = 0;
+        int isChild = waitid(P_PID, record.pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0;
+        int pidfd = -1;
+        if (!isChild && (pidfd = pidfd_open(record.pid)) == -1)
+            continue;
+        Job* job = add_job(record.pid, command);
+        job->job_id = record.jobId;
+        job->pidfd = pidfd;
+        job->startTime = record.startTime;
+        job->startClock = monoNow - (realNow - record.startTime);
+        running++;
+        children += isChild;
+    }
+    next_job_id = header.nextJobId > maxId ? header.nextJobId : maxId + 1;
+    status_jobs();
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    if (children > 0)
+        raise(SIGCHLD);  // reap any that ended before the handler was installed
+
+    if (aliasShm != NULL) {
+        char key[ALIAS_KEY_MAX + 1];
+        for (uint32_t i = 0; i < header.aliasCount && end - ptr >= 5; i++) {
+            uint8_t keyLen = *ptr;
+            uint32_t valueLen;
+            memcpy(&valueLen, ptr + 1, sizeof(valueLen));
+            if (keyLen >= sizeof(key) || (size_t)(end - ptr - 5) < (size_t)keyLen + valueLen)
+                break;
+            memcpy(key, ptr + 5, keyLen);
+            key[keyLen] = '\0';
+            shm_store(aliasShm, key, (const char*)ptr + 5 + keyLen, valueLen);
+            ptr += 5 + keyLen + valueLen;
+        }
+    } else {
+        freeDictionary(dict);
+        initDictionary(dict);
+        link_alias_records(dict, ptr, end, header.aliasCount);
+    }
+    aliasDirty = 1;
+    aliasGeneration++;
+    munmap(map, st.st_size);
+    printf("restored %u aliases and %d of %u jobs in %.2f ms\n", header.aliasCount, running, header.jobCount,
+           (now_ns(CLOCK_MONOTONIC) - started) / 1e6);
+    return 1;
+}
+
+#define MAX_WAIT_TARGETS 256
+
+// Handles wait [-n] [-t SECONDS] [%JOB | PID ...]; sets lastExitStatus and
+// returns 1 when every awaited job finished successfully
+int handle_wait(char** arr, int count) {
+    int anyOne = 0;
+    double timeout = -1;
+    pid_t targets[MAX_WAIT_TARGETS];
+    int targetCount = 0;
+    int missing = 0;
+    int finishedStatus = -1;   // status of a target that had already finished
+    int finishedFailed = 0;
+
+    // SIGCHLD stays blocked while waiting so the handler cannot reap our targets
+    sigset_t block, prev;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &prev);
+
+    for (int i = 1; i < count; i++) {
+        if (strcmp(arr[i], "-n") == 0) {
+            anyOne = 1;
+        } else if (strcmp(arr[i], "-t") == 0 && i + 1 < count) {
+            char* end;
+            timeout = strtod(arr[++i], &end);
+            if (*end != '\0' || timeout < 0) {
+                sigprocmask(SIG_SETMASK, &prev, NULL);
+                fprintf(stderr, "ERR\n");
+                lastExitStatus = 2;
+                return 0;
+            }
+        } else {
+            char* end;
+            long id = strtol(arr[i][0] == '%' ? arr[i] + 1 : arr[i], &end, 10);
+            pid_t pid = arr[i][0] == '%' ? 0 : (pid_t)id;
+            int job_id = arr[i][0] == '%' ? (int)id : 0;
+            Job* job = *end == '\0' && id > 0 ? find_job(pid, job_id) : NULL;
+            const LedgerEntry* done = job == NULL && *end == '\0' && id > 0 ? ledger_find(pid, job_id) : NULL;
+            if (done != NULL) {
+                // Already reaped: report the status the ledger recorded
+                finishedStatus = decode_status(done->status);
+                if (finishedStatus != 0)
+                    finishedFailed = 1;
+            } else if (job == NULL)
+                missing = 1;
+            else if (targetCount < MAX_WAIT_TARGETS)
+                targets[targetCount++] = job->pid;
+        }
+    }
+    // No operands: every running job
+    if (count - 1 == anyOne + (timeout >= 0 ? 2 : 0)) {
+        for (Job* current = job_list; current != NULL && targetCount < MAX_WAIT_TARGETS; current = current->next)
+            targets[targetCount++] = current->pid;
+    }
+
+    struct pollfd fds[MAX_WAIT_TARGETS];
+    int usePidfd = 1;
+    for (int i = 0; i < targetCount; i++) {
+        fds[i].fd = pidfd_open(targets[i]);
+        fds[i].events = POLLIN;
+        if (fds[i].fd == -1)
+            usePidfd = 0;
+    }
+
+    int64_t deadline = timeout >= 0 ? now_ns(CLOCK_MONOTONIC) + (int64_t)(timeout * 1e9) : -1;
+    int remaining = targetCount;
+    int allOk = 1;
+    int timedOut = 0;
+    lastExitStatus = missing ? 127 : finishedStatus >= 0 ? finishedStatus : 0;
+    if (finishedFailed)
+        allOk = 0;
+    while (remaining > 0) {
+        int waitMs = -1;
+        if (deadline >= 0) {
+            int64_t left = deadline - now_ns(CLOCK_MONOTONIC);
+            waitMs = left > 0 ? (int)((left + 999999) / 1000000) : 0;
+        }
+
+        if (usePidfd) {
+            int ready = poll(fds, targetCount, waitMs);
+            if (ready == -1 && errno != EINTR) {
+                perror("poll");
+                break;
+            }
+            if (ready == 0) {
+                timedOut = 1;
+                break;
+            }
+        } else {
+            // No pidfd support: sleep on the blocked SIGCHLD itself
+            struct timespec ts = { waitMs / 1000, (long)(waitMs % 1000) * 1000000 };
+            int sig = sigtimedwait(&block, NULL, waitMs >= 0 ? &ts : NULL);
+            if (sig == -1 && errno == EAGAIN) {
+                timedOut = 1;
+                break;
+            }
+        }
+
+        int reaped = 0;
+        for (int i = 0; i < targetCount; i++) {
+            if (targets[i] == 0)
+                continue;
+            int status;
+            struct rusage usage;
+            pid_t pid = wait4(targets[i], &status, WNOHANG, &usage);
+            if (pid == -1 && errno == ECHILD) {
+                // A re-adopted job: its pidfd turned readable, the status is not ours to collect
+                Job* job = find_job(targets[i], 0);
+                struct pollfd fd = { job != NULL ? job->pidfd : -1, POLLIN, 0 };
+                if (job == NULL || fd.fd == -1 || poll(&fd, 1, 0) != 1)
+                    continue;
+                adopted_finished(job);
+                lastExitStatus = decode_status(STATUS_UNKNOWN);
+                allOk = 0;
+                if (fds[i].fd != -1)
+                    close(fds[i].fd);
+                fds[i].fd = -1;
+                targets[i] = 0;
+                remaining--;
+                reaped++;
+                continue;
+            }
+            if (pid != targets[i])
+                continue;
+            lastExitStatus = decode_status(status);
+            if (!(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+                allOk = 0;
+            job_finished(pid, status, &usage);
+            if (fds[i].fd != -1)
+                close(fds[i].fd);
+            fds[i].fd = -1;  // poll ignores negative descriptors
+            targets[i] = 0;
+            remaining--;
+            reaped++;
+        }
+        if (anyOne && reaped > 0)
+            break;
+    }
+
+    for (int i = 0; i < targetCount; i++) {
+        if (fds[i].fd != -1)
+            close(fds[i].fd);
+    }
+    // Children of other jobs that ended meanwhile are reaped by the handler once unblocked
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+
+    if (timedOut) {
+        lastExitStatus = 124;
+        return 0;
+    }
+    return !missing && allOk;
+}
+// I/O backends. stdio is the plain fgets/waitpid loop. epoll and uring read
+// input and scripts in large chunks, route the shell's own stdout through a
+// buffer written at sync points, and wait for foreground children without
+// a blocking waitpid. uring batches the output write with the next read
+// into one io_uring_enter and waits for children with IORING_OP_WAITID.
+#define IO_STDIO 0
+#define IO_EPOLL 1
+#define IO_URING 2
+#define IO_OUT_SIZE 65536
+#define IO_READ_SIZE 65536
+#define URING_OP_WAITID 50   // IORING_OP_WAITID, newer than the installed headers
+
+const char* ioBackendNames[] = { "stdio", "epoll", "uring" };
+int ioBackend = IO_STDIO;
+long ioSyscalls = 0;   // syscalls made by the epoll/uring backends
+long ioCommands = 0;   // command lines run since startup
+long aheadPrepared = 0, aheadUsed = 0, aheadDiscarded = 0;   // script read-ahead
+
+// Buffered input for stdin and for scripts
+typedef struct LineReader {
+    int fd;
+    char* buf;
+    size_t start, end;
+    int eof;
+} LineReader;
+
+typedef struct IoRing {
+    int fd;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    struct io_uring_sqe* sqes;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe* cqes;
+    unsigned queued;     // sqes written since the last enter
+    int hasWaitid;
+} IoRing;
+
+IoRing ring = { .fd = -1 };
+int ioEpollFd = -1;
+int ioSignalFd = -1;
+char ioOut[IO_OUT_SIZE];
+size_t ioOutUsed = 0;
+FILE* ioRealStdout = NULL;
+
+int uring_setup(unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd == -1)
+        return 0;
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cqSize > sqSize)
+            sqSize = cqSize;
+        cqSize = sqSize;
+    }
+    char* sq = (char*)mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    char* cq = sq;
+    if (sq != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP))
+        cq = (char*)mmap(NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    struct io_uring_sqe* sqes = (struct io_uring_sqe*)mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+                                                           PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                                           IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+        close(fd);
+        return 0;
+    }
+
+    ring.fd = fd;
+    ring.sqHead = (unsigned*)(sq + params.sq_off.head);
+    ring.sqTail = (unsigned*)(sq + params.sq_off.tail);
+    ring.sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring.sqArray = (unsigned*)(sq + params.sq_off.array);
+    ring.sqes = sqes;
+    ring.cqHead = (unsigned*)(cq + params.cq_off.head);
+    ring.cqTail = (unsigned*)(cq + params.cq_off.tail);
+    ring.cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // Probe for IORING_OP_WAITID (Linux 6.7+); without it children are waited via pidfd polls
+    struct {
+        struct io_uring_probe probe;
+        struct io_uring_probe_op ops[256];
+    } probe;
+    memset(&probe, 0, sizeof(probe));
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, &probe, 256) == 0 &&
+        probe.probe.last_op >= URING_OP_WAITID && (probe.ops[URING_OP_WAITID].flags & IO_URING_OP_SUPPORTED))
+        ring.hasWaitid = 1;
+    return 1;
+}
+
+// Takes the next free sqe and clears it
+struct io_uring_sqe* uring_sqe(int opcode, int fd) {
+    unsigned tail = *ring.sqTail;
+    unsigned index = tail & *ring.sqMask;
+    struct io_uring_sqe* sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (unsigned char)opcode;
+    sqe->fd = fd;
+    ring.sqArray[index] = index;
+    __atomic_store_n(ring.sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring.queued++;
+    return sqe;
+}
+
+// Submits everything queued and waits for that many completions; results go to res[] by user_data
+int uring_run(int* res, int resCount) {
+    unsigned toSubmit = ring.queued;
+    unsigned total = ring.queued;
+    unsigned done = 0;
+    ring.queued = 0;
+    while (done < total) {
+        ioSyscalls++;
+        int ret = (int)syscall(__NR_io_uring_enter, ring.fd, toSubmit, total - done, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret == -1 && errno != EINTR)
+            return -1;
+        if (ret > 0)
+            toSubmit -= (unsigned)ret < toSubmit ? (unsigned)ret : toSubmit;
+        unsigned head = *ring.cqHead;
+        while (head != __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cqMask];
+            if (cqe->user_data < (unsigned long long)resCount)
+                res[cqe->user_data] = cqe->res;
+            head++;
+            done++;
+        }
+        __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+// fopencookie write hook: stdout bytes collect in ioOut until the next sync point
+ssize_t io_cookie_write(void* cookie, const char* data, size_t size) {
+    (void)cookie;
+    size_t done = 0;
+    while (done < size) {
+        if (ioOutUsed == IO_OUT_SIZE) {
+            // Full buffer: write it out directly
+            ioSyscalls++;
+            if (write(STDOUT_FILENO, ioOut, ioOutUsed) == -1)
+                return done > 0 ? (ssize_t)done : -1;
+            ioOutUsed = 0;
+        }
+        size_t chunk = size - done < IO_OUT_SIZE - ioOutUsed ? size - done : IO_OUT_SIZE - ioOutUsed;
+        memcpy(ioOut + ioOutUsed, data + done, chunk);
+        ioOutUsed += chunk;
+        done += chunk;
+    }
+    return (ssize_t)size;
+}
+
+// Writes whatever part of ioOut a partial write left behind
+void io_out_rest(int written) {
+    size_t off = written > 0 ? (size_t)written : 0;
+    while (off < ioOutUsed) {
+        ioSyscalls++;
+        ssize_t n = write(STDOUT_FILENO, ioOut + off, ioOutUsed - off);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        off += (size_t)n;
+    }
+    ioOutUsed = 0;
+}
+
+// Sync point: the shell's pending output reaches the terminal before anything else happens
+void io_flush_output() {
+    fflush(stdout);
+    if (ioOutUsed == 0)
+        return;
+    if (ioBackend == IO_URING) {
+        int res[1] = { 0 };
+        struct io_uring_sqe* sqe = uring_sqe(IORING_OP_WRITE, STDOUT_FILENO);
+        sqe->addr = (unsigned long)ioOut;
+        sqe->len = (unsigned)ioOutUsed;
+        sqe->off = (unsigned long long)-1;
+        sqe->user_data = 0;
+        uring_run(res, 1);
+        io_out_rest(res[0]);
+    } else {
+        io_out_rest(0);
+    }
+}
+
+// Refills a reader; for uring the pending output write rides in the same enter
+ssize_t io_fill(LineReader* reader) {
+    if (reader->start > 0) {
+        memmove(reader->buf, reader->buf + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+    size_t room = IO_READ_SIZE - reader->end;
+    fflush(stdout);
+
+    if (ioBackend == IO_URING) {
+        int res[2] = { 0, 0 };
+        int hadOutput = ioOutUsed > 0;
+        if (hadOutput) {
+            struct io_uring_sqe* sqe = uring_sqe(IORING_OP_WRITE, STDOUT_FILENO);
+            sqe->addr = (unsigned long)ioOut;
+            sqe->len = (unsigned)ioOutUsed;
+            sqe->off = (unsigned long long)-1;
+            sqe->flags = IOSQE_IO_LINK;
+            sqe->user_data = 0;
+        }
+        struct io_uring_sqe* sqe = uring_sqe(IORING_OP_READ, reader->fd);
+        sqe->addr = (unsigned long)(reader->buf + reader->end);
+        sqe->len = (unsigned)room;
+        sqe->off = (unsigned long long)-1;
+        sqe->user_data = 1;
+        if (uring_run(res, 2) == -1)
+            return -1;
+        if (hadOutput)
+            io_out_rest(res[0]);
+        if (res[1] == -EINTR || res[1] == -ECANCELED)
+            return io_fill(reader);
+        if (res[1] < 0) {
+            errno = -res[1];
+            return -1;
+        }
+        reader->end += (size_t)res[1];
+        return res[1];
+    }
+
+    if (ioBackend == IO_EPOLL)
+        io_flush_output();
+    ssize_t n;
+    do {
+        if (ioBackend != IO_STDIO)
+            ioSyscalls++;
+        n = read(reader->fd, reader->buf + reader->end, room);
+    } while (n == -1 && errno == EINTR);
+    if (n > 0)
+        reader->end += (size_t)n;
+    return n;
+}
+
+// fgets over a LineReader: returns 0 at end of input, keeps the '\n' like fgets
+int reader_next_line(LineReader* reader, char* line, size_t size) {
+    while (1) {
+        char* start = reader->buf + reader->start;
+        size_t avail = reader->end - reader->start;
+        char* nl = (char*)memchr(start, '\n', avail);
+        size_t take = nl != NULL ? (size_t)(nl - start) + 1 : avail;
+        if (take > size - 1)
+            take = size - 1;
+        if (nl != NULL || take == size - 1 || (reader->eof && avail > 0)) {
+            memcpy(line, start, take);
+            line[take] = '\0';
+            reader->start += take;
+            return 1;
+        }
+        if (reader->eof || avail == IO_READ_SIZE)
+            return 0;
+        ssize_t n = io_fill(reader);
+        if (n <= 0)
+            reader->eof = 1;
+    }
+}
+
+LineReader* reader_open(int fd) {
+    LineReader* reader = (LineReader*)malloc(sizeof(LineReader));
+    char* buf = (char*)malloc(IO_READ_SIZE);
+    if (reader == NULL || buf == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    reader->fd = fd;
+    reader->buf = buf;
+    reader->start = reader->end = 0;
+    reader->eof = 0;
+    return reader;
+}
+
+void reader_close(LineReader* reader) {
+    free(reader->buf);
+    free(reader);
+}
+
+// Picks the backend at startup; uring falls back to epoll when the kernel refuses a ring
+void io_init(const char* name) {
+    if (name == NULL || strcmp(name, "stdio") == 0)
+        return;
+    if (strcmp(name, "uring") == 0 && uring_setup(16))
+        ioBackend = IO_URING;
+    else if (strcmp(name, "uring") == 0 || strcmp(name, "epoll") == 0)
+        ioBackend = IO_EPOLL;
+    else {
+        fprintf(stderr, "ERR\n");
+        return;
+    }
+
+    if (ioBackend == IO_EPOLL) {
+        // SIGCHLD arrives through a signalfd while a foreground child runs
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        ioEpollFd = epoll_create1(EPOLL_CLOEXEC);
+        ioSignalFd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+        struct epoll_event ev = { .events = EPOLLIN, .data.fd = ioSignalFd };
+        if (ioEpollFd == -1 || ioSignalFd == -1 || epoll_ctl(ioEpollFd, EPOLL_CTL_ADD, ioSignalFd, &ev) == -1) {
+            perror("epoll");
+            ioBackend = IO_STDIO;
+            return;
+        }
+    }
+
+    // The shell's own stdout goes through io_cookie_write
+    cookie_io_functions_t functions = { NULL, io_cookie_write, NULL, NULL };
+    FILE* out = fopencookie(NULL, "w", functions);
+    if (out != NULL) {
+        ioRealStdout = stdout;
+        setvbuf(out, NULL, _IOFBF, BUFSIZ);
+        stdout = out;
+    }
+}
+
+// Waits for a foreground child; SIGCHLD must be blocked since before the fork
+pid_t io_wait_child(pid_t pid, int* status) {
+    if (ioBackend == IO_URING && ring.hasWaitid) {
+        siginfo_t info;
+        memset(&info, 0, sizeof(info));
+        int res[1] = { 0 };
+        struct io_uring_sqe* sqe = uring_sqe(URING_OP_WAITID, pid);
+        sqe->len = P_PID;
+        sqe->file_index = WEXITED;
+        sqe->addr2 = (unsigned long)&info;
+        sqe->user_data = 0;
+        if (uring_run(res, 1) == 0 && res[0] == 0) {
+            // Rebuild the waitpid-style status word from the siginfo
+            if (info.si_code == CLD_EXITED)
+                *status = (info.si_status & 0xff) << 8;
+            else
+                *status = (info.si_status & 0x7f) | (info.si_code == CLD_DUMPED ? 0x80 : 0);
+            return pid;
+        }
+    }
+    if (ioBackend == IO_URING) {
+        // No IORING_OP_WAITID: poll the child's pidfd through the ring
+        int pidfd = pidfd_open(pid);
+        ioSyscalls++;
+        if (pidfd != -1) {
+            int res[1] = { 0 };
+            struct io_uring_sqe* sqe = uring_sqe(IORING_OP_POLL_ADD, pidfd);
+            sqe->poll32_events = POLLIN;
+            sqe->user_data = 0;
+            uring_run(res, 1);
+            close(pidfd);
+            ioSyscalls++;
+        }
+    }
+    if (ioBackend == IO_EPOLL) {
+        while (1) {
+            ioSyscalls++;
+            struct rusage usage;
+            pid_t done = wait4(-1, status, WNOHANG, &usage);
+            if (done == pid)
+                return pid;
+            if (done > 0) {
+                int other = *status;
+                job_finished(done, other, &usage);  // a background job ended meanwhile
+                continue;
+            }
+            if (done == -1 && errno != EINTR)
+                return -1;
+            struct epoll_event ev;
+            struct signalfd_siginfo si;
+            ioSyscalls += 2;
+            if (epoll_wait(ioEpollFd, &ev, 1, -1) > 0 && read(ioSignalFd, &si, sizeof(si)) == -1 && errno != EAGAIN)
+                return -1;
+        }
+    }
+    if (ioBackend != IO_STDIO)
+        ioSyscalls++;
+    pid_t done;
+    do {
+        done = waitpid(pid, status, 0);
+    } while (done == -1 && errno == EINTR);
+    return done;
+}
+
+// In a forked subshell: the ring and the epoll set belong to the parent,
+// so the child keeps its buffered stdout but writes and waits the plain way
+void io_fork_child() {
+    if (ioBackend == IO_STDIO)
+        return;
+    fflush(stdout);
+    io_out_rest(0);
+    if (ring.fd != -1)
+        close(ring.fd);
+    if (ioEpollFd != -1)
+        close(ioEpollFd);
+    if (ioSignalFd != -1)
+        close(ioSignalFd);
+    ring.fd = ioEpollFd = ioSignalFd = -1;
+    ioBackend = IO_STDIO;
+}
+
+// Flushes the shell's output and restores the real stdout on exit
+void io_shutdown() {
+    if (ioRealStdout != NULL) {
+        io_flush_output();
+        fclose(stdout);
+        stdout = ioRealStdout;
+        ioRealStdout = NULL;
+    }
+}
+
+// Read and write syscalls of the shell's main thread so far, as counted by
+// the kernel (/proc/self/io would add those of every reaped child)
+void proc_io_syscalls(long* reads, long* writes) {
+    char line[128];
+    *reads = *writes = -1;
+    FILE* file = fopen("/proc/thread-self/io", "r");
+    if (file == NULL)
+        return;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, "syscr:", 6) == 0)
+            *reads = atol(line + 6);
+        else if (strncmp(line, "syscw:", 6) == 0)
+            *writes = atol(line + 6);
+    }
+    fclose(file);
+}
+
+// iostat: backend, command count, the backend's own calls and the kernel's
+// read/write syscall counts, which cover the stdio backend too
+void print_io_stats() {
+    printf("backend %s%s\n", ioBackendNames[ioBackend],
+           ioBackend == IO_URING ? (ring.hasWaitid ? " (waitid)" : " (pidfd poll)") : "");
+    if (ioBackend == IO_STDIO)
+        printf("commands %ld\n", ioCommands);
+    else
+        printf("commands %ld, backend calls %ld, per command %.2f\n", ioCommands, ioSyscalls,
+               ioCommands > 0 ? (double)ioSyscalls / ioCommands : 0.0);
+    long reads, writes;
+    proc_io_syscalls(&reads, &writes);
+    if (reads >= 0 && writes >= 0)
+        printf("read/write syscalls %ld + %ld, per command %.2f\n", reads, writes,
+               ioCommands > 0 ? (double)(reads + writes) / ioCommands : 0.0);
+    printf("read-ahead: %ld lines prepared, %ld used, %ld discarded\n", aheadPrepared, aheadUsed, aheadDiscarded);
+}
+
+// Shell variables: NAME=value assignments, export/unset and $VAR expansion.
+// Each variable keeps its "NAME=value" string, so the envp handed to exec is
+// just an array of pointers that is rebuilt only after an exported variable changed.
+typedef struct Variable {
+    char* entry;             // "NAME=value"
+    size_t nameLen;
+    int exported;
+    struct Variable* hnext;
+} Variable;
+
+typedef struct VariableTable {
+    Variable** buckets;
+    int bucketCount;
+    int count;
+    int exportedCount;
+    char** envp;             // cached environment for children
+    int envDirty;
+    size_t envBytes;         // what envp adds to the execve argument space
+} VariableTable;
+
+VariableTable variables = {NULL, 0, 0, 0, NULL, 1, 0};
+
+const char* variable_value(const Variable* var) {
+    return var->entry + var->nameLen + 1;
+}
+
+// Hashes the first len bytes of a name (FNV-1a, like hashKey)
+unsigned int hash_name(const char* name, size_t len) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+Variable* find_variable(const char* name, size_t len) {
+    if (variables.buckets == NULL)
+        return NULL;
+    Variable* current = variables.buckets[hash_name(name, len) % variables.bucketCount];
+    for (; current != NULL; current = current->hnext) {
+        if (current->nameLen == len && strncmp(current->entry, name, len) == 0)
+            return current;
+    }
+    return NULL;
+}
+
+void grow_variables() {
+    int newCount = variables.bucketCount ? variables.bucketCount * 2 : 256;
+    Variable** buckets = (Variable**)calloc(newCount, sizeof(Variable*));
+    if (buckets == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < variables.bucketCount; i++) {
+        Variable* current = variables.buckets[i];
+        while (current != NULL) {
+            Variable* next = current->hnext;
+            unsigned int b = hash_name(current->entry, current->nameLen) % newCount;
+            current->hnext = buckets[b];
+            buckets[b] = current;
+            current = next;
+        }
+    }
+    free(variables.buckets);
+    variables.buckets = buckets;
+    variables.bucketCount = newCount;
+}
+
+// Sets (and optionally exports) a variable; value NULL keeps the current value
+void set_variable(const char* name, size_t len, const char* value, int exported) {
+    Variable* var = find_variable(name, len);
+    if (var == NULL) {
+        if (variables.count >= variables.bucketCount * 2)
+            grow_variables();
+        var = (Variable*)calloc(1, sizeof(Variable));
+        if (var == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        var->nameLen = len;
+        unsigned int b = hash_name(name, len) % variables.bucketCount;
+        var->hnext = variables.buckets[b];
+        variables.buckets[b] = var;
+        variables.count++;
+        if (value == NULL)
+            value = "";
+    }
+    if (value != NULL) {
+        size_t valueLen = strlen(value);
+        char* entry = (char*)malloc(len + valueLen + 2);
+        if (entry == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(entry, name, len);
+        entry[len] = '=';
+        memcpy(entry + len + 1, value, valueLen + 1);
+        free(var->entry);
+        var->entry = entry;
+        if (var->exported)
+            variables.envDirty = 1;
+    }
+    if (exported && !var->exported) {
+        var->exported = 1;
+        variables.exportedCount++;
+        variables.envDirty = 1;
+    }
+    // execvpe and the completion index look PATH up in our own environment
+    if (var->exported && len == 4 && strncmp(name, "PATH", 4) == 0) {
+        setenv("PATH", variable_value(var), 1);
+        clear_path_cache();
+    }
+}
+
+int unset_variable(const char* name) {
+    size_t len = strlen(name);
+    if (variables.buckets == NULL)
+        return 0;
+    Variable** link = &variables.buckets[hash_name(name, len) % variables.bucketCount];
+    while (*link != NULL) {
+        Variable* current = *link;
+        if (current->nameLen == len && strncmp(current->entry, name, len) == 0) {
+            *link = current->hnext;
+            if (current->exported) {
+                variables.exportedCount--;
+                variables.envDirty = 1;
+                if (len == 4 && strcmp(name, "PATH") == 0) {
+                    unsetenv("PATH");
+                    clear_path_cache();
+                }
+            }
+            free(current->entry);
+            free(current);
+            variables.count--;
+            return 1;
+        }
+        link = &current->hnext;
+    }
+    return 0;
+}
+
+// Imports the environment the shell was started with, all exported
+void init_variables() {
+    extern char** environ;
+    grow_variables();
+    for (char** env = environ; *env != NULL; env++) {
+        const char* eq = strchr(*env, '=');
+        if (eq != NULL && eq != *env)
+            set_variable(*env, eq - *env, eq + 1, 1);
+    }
+}
+
+// Environment for a child; rebuilt only after an exported variable changed
+char** shell_envp() {
+    if (!variables.envDirty)
+        return variables.envp;
+    char** envp = (char**)realloc(variables.envp, (variables.exportedCount + 1) * sizeof(char*));
+    if (envp == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    int n = 0;
+    variables.envBytes = sizeof(char*);
+    for (int i = 0; i < variables.bucketCount; i++) {
+        for (Variable* current = variables.buckets[i]; current != NULL; current = current->hnext) {
+            if (current->exported) {
+                envp[n++] = current->entry;
+                variables.envBytes += strlen(current->entry) + 1 + sizeof(char*);
+            }
+        }
+    }
+    envp[n] = NULL;
+    variables.envp = envp;
+    variables.envDirty = 0;
+    return envp;
+}
+
+int is_name_char(char c, int first) {
+    return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (!first && c >= '0' && c <= '9');
+}
+
+// Length of the NAME in a NAME=... word, or 0 if the word is not an assignment
+size_t assignment_name(const char* word) {
+    size_t len = 0;
+    while (is_name_char(word[len], len == 0))
+        len++;
+    return len > 0 && word[len] == '=' ? len : 0;
+}
+
+// Copies src to out expanding $NAME, ${NAME}, $? and $$ outside single quotes.
+// Resolves the $ reference at ref: returns its value and sets *end to the
+// last byte of the reference. A lone '$' gives NULL; an unterminated ${
+// gives NULL with *end set to NULL. number holds $? / $$ (16 bytes)
+const char* variable_reference(const char* ref, const char** end, char* number) {
+    const char* name = ref + 1;
+    size_t len = 0;
+    *end = ref;
+    if (*name == '?' || *name == '$') {
+        snprintf(number, 16, "%d", *name == '?' ? lastExitStatus : (int)getpid());
+        *end = name;
+        return number;
+    }
+    if (*name == '{') {
+        name++;
+        while (is_name_char(name[len], len == 0))
+            len++;
+        if (len == 0 || name[len] != '}') {
+            *end = NULL;
+            return NULL;
+        }
+        *end = name + len;
+    } else {
+        while (is_name_char(name[len], len == 0))
+            len++;
+        if (len == 0)
+            return NULL;
+        *end = name + len - 1;
+    }
+    Variable* var = find_variable(name, len);
+    return var != NULL ? variable_value(var) : "";
+}
+
+// Returns 0 on success, -1 if the result does not fit or ${ is unterminated
+int expand_variables(const char* src, char* out, size_t size) {
+    size_t used = 0;
+    char quote = 0;
+    for (const char* ptr = src; *ptr; ptr++) {
+        if (quote == 0 && (*ptr == '\'' || *ptr == '"'))
+            quote = *ptr;
+        else if (quote == *ptr)
+            quote = 0;
+
+        if (*ptr == '$' && quote != '\'') {
+            char number[16];
+            const char* end;
+            const char* value = variable_reference(ptr, &end, number);
+            if (end == NULL)
+                return -1;
+            if (value != NULL) {
+                size_t valueLen = strlen(value);
+                if (used + valueLen >= size)
+                    return -1;
+                memcpy(out + used, value, valueLen);
+                used += valueLen;
+                ptr = end;
+                continue;
+            }
+            // a lone '$' is kept as is
+        }
+        if (used + 1 >= size)
+            return -1;
+        out[used++] = *ptr;
+    }
+    out[used] = '\0';
+    return 0;
+}
+
+// Appends len bytes to a growing heap string
+void append_text(char** text, size_t* used, size_t* cap, const char* add, size_t len) {
+    if (*used + len + 1 > *cap) {
+        *cap = (*used + len + 1) * 2;
+        *text = (char*)realloc(*text, *cap);
+        if (*text == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(*text + *used, add, len);
+    *used += len;
+    (*text)[*used] = '\0';
+}
+
+// Runs a line made only of NAME=value words. Returns 1 if it was one;
+// a line like "A=1 cmd" is left to the normal command path. Takes the line
+// before expansion: $ references are expanded inside each value, so what a
+// variable holds never becomes words or operators of the line
+int handle_assignments(const char* line) {
+    const char* names[64];
+    size_t lens[64];
+    char* values[64];
+    int n = 0, ok = 1;
+    const char* ptr = line;
+    while (*ptr) {
+        while (*ptr == ' ')
+            ptr++;
+        if (*ptr == '\0')
+            break;
+        size_t len = assignment_name(ptr);
+        if (len == 0 || n == 64) {
+            ok = 0;
+            break;
+        }
+        names[n] = ptr;
+        lens[n] = len;
+        ptr += len + 1;
+        // The value runs to the next space, quotes group words together
+        size_t used = 0, cap = 0;
+        char quote = 0;
+        values[n] = NULL;
+        append_text(&values[n], &used, &cap, "", 0);
+        n++;
+        while (*ptr && (quote || *ptr != ' ')) {
+            if (quote == 0 && (*ptr == '\'' || *ptr == '"')) {
+                quote = *ptr;
+            } else if (quote == *ptr) {
+                quote = 0;
+            } else if (*ptr == '$' && quote != '\'') {
+                char number[16];
+                const char* end;
+                const char* value = variable_reference(ptr, &end, number);
+                if (end == NULL) {
+                    ok = 0;   // unterminated ${: the command path reports ERR
+                    break;
+                }
+                if (value != NULL) {
+                    append_text(&values[n - 1], &used, &cap, value, strlen(value));
+                    ptr = end;
+                } else {
+                    append_text(&values[n - 1], &used, &cap, ptr, 1);
+                }
+            } else {
+                append_text(&values[n - 1], &used, &cap, ptr, 1);
+            }
+            ptr++;
+        }
+        if (!ok)
+            break;
+    }
+    for (int i = 0; i < n; i++) {
+        if (ok)
+            set_variable(names[i], lens[i], values[i], 0);
+        free(values[i]);
+    }
+    return ok && n > 0;
+}
+
+// export [NAME[=value] ...] / unset NAME ...
+int handle_export(char** arr, int count) {
+    if (strcmp(arr[0], "unset") == 0) {
+        if (count < 2) {
+            fprintf(stderr, "ERR\n");
+            return 0;
+        }
+        for (int i = 1; i < count; i++)
+            unset_variable(arr[i]);
+        return 1;
+    }
+    if (count == 1) {
+        char** envp = shell_envp();
+        for (int i = 0; envp[i] != NULL; i++)
+            printf("export %s\n", envp[i]);
+        return 1;
+    }
+    for (int i = 1; i < count; i++) {
+        size_t len = assignment_name(arr[i]);
+        if (len > 0) {
+            set_variable(arr[i], len, arr[i] + len + 1, 1);
+        } else {
+            len = strlen(arr[i]);
+            for (size_t k = 0; k < len; k++) {
+                if (!is_name_char(arr[i][k], k == 0)) {
+                    fprintf(stderr, "ERR\n");
+                    return 0;
+                }
+            }
+            if (len == 0) {
+                fprintf(stderr, "ERR\n");
+                return 0;
+            }
+            set_variable(arr[i], len, NULL, 1);
+        }
+    }
+    return 1;
+}
+
+// argv for exec. The first ARGV_INLINE words live in the struct itself and
+// longer commands move to the heap; the words are borrowed, never copied
+#define ARGV_INLINE 16
+#define ARGV_MAX_STRLEN (32 * 4096)   // Linux MAX_ARG_STRLEN: longest single argument
+
+typedef struct ArgVector {
+    char** items;            // inlineItems or a heap array, NULL-terminated
+    int count;
+    int capacity;
+    size_t bytes;            // strings and pointers, as execve counts them
+    size_t longest;
+    char* inlineItems[ARGV_INLINE + 1];
+} ArgVector;
+
+void argv_init(ArgVector* argv) {
+    argv->items = argv->inlineItems;
+    argv->count = 0;
+    argv->capacity = ARGV_INLINE;
+    argv->bytes = sizeof(char*);
+    argv->longest = 0;
+    argv->items[0] = NULL;
+}
+
+void argv_append(ArgVector* argv, char** words, int count) {
+    if (argv->count + count > argv->capacity) {
+        int capacity = argv->capacity;
+        while (capacity < argv->count + count)
+            capacity *= 2;
+        char** items = (char**)malloc((capacity + 1) * sizeof(char*));
+        if (items == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(items, argv->items, argv->count * sizeof(char*));
+        if (argv->items != argv->inlineItems)
+            free(argv->items);
+        argv->items = items;
+        argv->capacity = capacity;
+    }
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(words[i]) + 1;
+        argv->items[argv->count++] = words[i];
+        argv->bytes += len + sizeof(char*);
+        if (len > argv->longest)
+            argv->longest = len;
+    }
+    argv->items[argv->count] = NULL;
+}
+
+void argv_free(ArgVector* argv) {
+    if (argv->items != argv->inlineItems)
+        free(argv->items);
+    argv->items = argv->inlineItems;
+}
+
+// Whether argv and the environment fit the kernel's limit for execve
+int argv_fits(ArgVector* argv) {
+    static long argMax = 0;
+    if (argMax == 0) {
+        argMax = sysconf(_SC_ARG_MAX);
+        if (argMax <= 0)
+            argMax = 131072;  // the POSIX minimum of old kernels
+    }
+    shell_envp();
+    return argv->longest <= ARGV_MAX_STRLEN && argv->bytes + variables.envBytes <= (size_t)argMax;
+}
+
+// Filename globbing. Directory listings are kept sorted in a small cache and
+// reused while the directory's device, inode and mtime are unchanged.
+#define GLOB_CACHE_SIZE 64
+
+typedef struct DirListing {
+    char* path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    int racy;                // listed within the mtime tick, so rescan next time
+    char** names;            // sorted, without . and ..
+    int count;
+    unsigned long lastUse;
+} DirListing;
+
+DirListing dirCache[GLOB_CACHE_SIZE];
+int dirCacheCount = 0;
+unsigned long dirCacheClock = 0;
+unsigned long globScans = 0, globHits = 0;
+int nullglob = 0;            // shopt -s nullglob: drop patterns that match nothing
+int globCache = 1;           // shopt -u globcache: rescan directories on every glob
+
+int compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+void free_listing(DirListing* listing) {
+    for (int i = 0; i < listing->count; i++)
+        free(listing->names[i]);
+    free(listing->names);
+    listing->names = NULL;
+    listing->count = 0;
+}
+
+// Sorted listing of a directory, from the cache when it is still valid
+DirListing* get_listing(const char* path) {
+    struct stat st;
+    if (stat(path, &st) == -1 || !S_ISDIR(st.st_mode))
+        return NULL;
+
+    DirListing* slot = NULL;
+    for (int i = 0; i < dirCacheCount; i++) {
+        if (strcmp(dirCache[i].path, path) == 0) {
+            slot = &dirCache[i];
+            break;
+        }
+    }
+    if (slot != NULL && globCache && !slot->racy && slot->dev == st.st_dev && slot->ino == st.st_ino &&
+        slot->mtime.tv_sec == st.st_mtim.tv_sec && slot->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        slot->lastUse = ++dirCacheClock;
+        globHits++;
+        return slot;
+    }
+
+    DIR* dir = opendir(path);
+    if (dir == NULL)
+        return NULL;
+    if (slot == NULL) {
+        if (dirCacheCount < GLOB_CACHE_SIZE) {
+            slot = &dirCache[dirCacheCount++];
+        } else {
+            // Evict the least recently used listing
+            slot = &dirCache[0];
+            for (int i = 1; i < dirCacheCount; i++) {
+                if (dirCache[i].lastUse < slot->lastUse)
+                    slot = &dirCache[i];
+            }
+            free(slot->path);
+            free_listing(slot);
+        }
+        slot->path = strdup(path);
+        if (slot->path == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        free_listing(slot);
+    }
+
+    int capacity = 64;
+    slot->names = (char**)malloc(capacity * sizeof(char*));
+    if (slot->names == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        if (slot->count == capacity) {
+            capacity *= 2;
+            char** names = (char**)realloc(slot->names, capacity * sizeof(char*));
+            if (names == NULL) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+            slot->names = names;
+        }
+        slot->names[slot->count] = strdup(entry->d_name);
+        if (slot->names[slot->count] == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        slot->count++;
+    }
+    closedir(dir);
+    qsort(slot->names, slot->count, sizeof(char*), compare_names);
+
+    // A change within the same timestamp tick would go unnoticed, so a
+    // directory modified in the last 10ms is not trusted on the next glob
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t age = (int64_t)(now.tv_sec - st.st_mtim.tv_sec) * 1000000000 + (now.tv_nsec - st.st_mtim.tv_nsec);
+    slot->racy = age < 10000000;
+    slot->dev = st.st_dev;
+    slot->ino = st.st_ino;
+    slot->mtime = st.st_mtim;
+    slot->lastUse = ++dirCacheClock;
+    globScans++;
+    return slot;
+}
+
+typedef struct GlobResult {
+    char** paths;
+    int count;
+    int capacity;
+} GlobResult;
+
+void glob_add(GlobResult* result, const char* path) {
+    if (result->count == result->capacity) {
+        result->capacity = result->capacity ? result->capacity * 2 : 16;
+        char** paths = (char**)realloc(result->paths, result->capacity * sizeof(char*));
+        if (paths == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        result->paths = paths;
+    }
+    result->paths[result->count] = strdup(path);
+    if (result->paths[result->count] == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    result->count++;
+}
+
+int has_glob_chars(const char* word) {
+    return strpbrk(word, "*?[") != NULL;
+}
+
+// Matches the components of pattern one directory at a time below base
+// ("" for the current directory, otherwise ending in '/')
+void glob_component(const char* base, const char* pattern, GlobResult* result) {
+    const char* slash = strchr(pattern, '/');
+    size_t len = slash != NULL ? (size_t)(slash - pattern) : strlen(pattern);
+    char component[256];
+    char path[PATH_MAX];
+    if (len >= sizeof(component))
+        return;
+    memcpy(component, pattern, len);
+    component[len] = '\0';
+
+    if (!has_glob_chars(component)) {
+        if ((size_t)snprintf(path, sizeof(path), "%s%s%s", base, component, slash ? "/" : "") >= sizeof(path))
+            return;
+        if (slash != NULL && slash[1] != '\0')
+            glob_component(path, slash + 1, result);
+        else if (access(path, F_OK) == 0)
+            glob_add(result, path);
+        return;
+    }
+
+    DirListing* listing = get_listing(base[0] ? base : ".");
+    if (listing == NULL)
+        return;
+    // Copy the matching names first: recursing may evict this listing
+    int matchCount = 0;
+    char** matches = (char**)malloc((listing->count + 1) * sizeof(char*));
+    if (matches == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    // The names are sorted, so only the range sharing the literal prefix is matched
+    size_t prefixLen = strcspn(component, "*?[\\");
+    int low = 0, high = listing->count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (strncmp(listing->names[mid], component, prefixLen) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    for (int i = low; i < listing->count && strncmp(listing->names[i], component, prefixLen) == 0; i++) {
+        if (fnmatch(component, listing->names[i], FNM_PERIOD) == 0) {
+            matches[matchCount] = strdup(listing->names[i]);
+            if (matches[matchCount] == NULL) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+            matchCount++;
+        }
+    }
+    for (int i = 0; i < matchCount; i++) {
+        struct stat st;
+        if ((size_t)snprintf(path, sizeof(path), "%s%s", base, matches[i]) >= sizeof(path))
+            continue;
+        if (slash == NULL) {
+            glob_add(result, path);
+        } else if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            strcat(path, "/");
+            if (slash[1] == '\0')
+                glob_add(result, path);
+            else
+                glob_component(path, slash + 1, result);
+        }
+        free(matches[i]);
+    }
+    free(matches);
+}
+
+// Replaces each unquoted word of arr holding *, ? or [...] by its sorted matches.
+// Quoting is read from the line the words were split from
+char** expand_globs(const char* line, char** arr, int* count) {
+    GlobResult words = {NULL, 0, 0};
+    const char* ptr = line;
+    for (int i = 0; i < *count; i++) {
+        while (*ptr == ' ')
+            ptr++;
+        int quoted = *ptr == '"' || *ptr == '\'';
+        // Step over the word the same way split_string does
+        if (quoted) {
+            char quote = *ptr++;
+            while (*ptr && *ptr != quote)
+                ptr++;
+            if (*ptr)
+                ptr++;
+        } else {
+            while (*ptr && *ptr != ' ')
+                ptr++;
+        }
+
+        if (quoted || !has_glob_chars(arr[i])) {
+            glob_add(&words, arr[i]);
+            continue;
+        }
+        GlobResult matches = {NULL, 0, 0};
+        if (arr[i][0] == '/')
+            glob_component("/", arr[i] + 1, &matches);
+        else
+            glob_component("", arr[i], &matches);
+        if (matches.count == 0 && !nullglob)
+            glob_add(&words, arr[i]);
+        qsort(matches.paths, matches.count, sizeof(char*), compare_names);
+        for (int k = 0; k < matches.count; k++) {
+            glob_add(&words, matches.paths[k]);
+            free(matches.paths[k]);
+        }
+        free(matches.paths);
+    }
+    // Make room for the terminating NULL
+    glob_add(&words, "");
+    free(words.paths[--words.count]);
+    words.paths[words.count] = NULL;
+    free_split_string(arr);
+    *count = words.count;
+    return words.paths;
+}
+
+// shopt [-s|-u nullglob|globcache]
+int handle_shopt(char** arr, int count) {
+    if (count == 1) {
+        printf("nullglob\t%s\n", nullglob ? "on" : "off");
+        printf("globcache\t%s (%d dirs, %lu scans, %lu hits)\n", globCache ? "on" : "off", dirCacheCount, globScans,
+               globHits);
+        return 1;
+    }
+    if (count != 3 || (strcmp(arr[1], "-s") != 0 && strcmp(arr[1], "-u") != 0)) {
+        fprintf(stderr, "ERR\n");
+        return 0;
+    }
+    int on = strcmp(arr[1], "-s") == 0;
+    if (strcmp(arr[2], "nullglob") == 0) {
+        nullglob = on;
+    } else if (strcmp(arr[2], "globcache") == 0) {
+        globCache = on;
+    } else {
+        fprintf(stderr, "ERR\n");
+        return 0;
+    }
+    return 1;
+}
+
+// Line lexer. One pass classifies spaces, quotes and the operator characters
+// & | > ( into bitmasks, 16 (SSE2) or 32 (AVX2) bytes per instruction; token
+// boundaries, the quote flag and the operator words are then read off the
+// masks instead of walking the line byte by byte.
+enum { LEX_SCALAR, LEX_SSE2, LEX_AVX2 };
+const char* lexImplNames[] = { "scalar", "sse2", "avx2" };
+int lexImpl = LEX_SCALAR;
+
+// Bit i of each mask describes byte i of a 64-byte block
+typedef struct LexBlock {
+    uint64_t space;
+    uint64_t squote;
+    uint64_t dquote;
+    uint64_t op;
+} LexBlock;
+
+void lex_block_scalar(const char* p, LexBlock* block) {
+    memset(block, 0, sizeof(*block));
+    for (int i = 0; i < 64; i++) {
+        uint64_t bit = (uint64_t)1 << i;
+        switch (p[i]) {
+            case ' ': block->space |= bit; break;
+            case '\'': block->squote |= bit; break;
+            case '"': block->dquote |= bit; break;
+            case '&': case '|': case '>': case '(': block->op |= bit; break;
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#include <immintrin.h>
+
+void lex_block_sse2(const char* p, LexBlock* block) {
+    memset(block, 0, sizeof(*block));
+    for (int i = 0; i < 64; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i op = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('&')), _mm_cmpeq_epi8(v, _mm_set1_epi8('|'))),
+                                  _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('>')), _mm_cmpeq_epi8(v, _mm_set1_epi8('('))));
+        block->space |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(' '))) << i;
+        block->squote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\''))) << i;
+        block->dquote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << i;
+        block->op |= (uint64_t)(uint16_t)_mm_movemask_epi8(op) << i;
+    }
+}
+
+__attribute__((target("avx2")))
+void lex_block_avx2(const char* p, LexBlock* block) {
+    memset(block, 0, sizeof(*block));
+    for (int i = 0; i < 64; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i op = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('|'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('('))));
+        block->space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '))) << i;
+        block->squote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\''))) << i;
+        block->dquote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))) << i;
+        block->op |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << i;
+    }
+}
+#endif
+
+// Picks the widest implementation the CPU has; $MINISHELL_LEX forces one
+void lex_init() {
+#if defined(__x86_64__) || defined(__SSE2__)
+    lexImpl = __builtin_cpu_supports("avx2") ? LEX_AVX2 : LEX_SSE2;
+#endif
+    const char* name = getenv("MINISHELL_LEX");
+    for (int i = 0; name != NULL && i <= lexImpl; i++) {
+        if (strcmp(name, lexImplNames[i]) == 0)
+            lexImpl = i;
+    }
+}
+
+// What the lexer found besides the words
+typedef struct LexInfo {
+    int hasApos;     // a ' or " anywhere in the line
+    int logicOp;     // index of the first unquoted && or || word, -1 if none
+    int redirect;    // index of the first unquoted 2> word, -1 if none
+} LexInfo;
+
+// Masks for a whole line, one LexBlock per 64 bytes
+typedef struct LexMasks {
+    LexBlock* blocks;
+    size_t count;
+    size_t len;
+} LexMasks;
+
+void lex_classify(const char* str, size_t len, LexMasks* masks) {
+    masks->len = len;
+    masks->count = (len + 63) / 64;
+    size_t full = len / 64;
+    for (size_t i = 0; i < masks->count; i++) {
+        const char* p = str + i * 64;
+        char tail[64];
+        if (i == full) {
+            // The last partial block is copied so the vector loads stay inside the line
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, p, len - i * 64);
+            p = tail;
+        }
+#if defined(__x86_64__) || defined(__SSE2__)
+        if (lexImpl == LEX_AVX2)
+            lex_block_avx2(p, &masks->blocks[i]);
+        else if (lexImpl == LEX_SSE2)
+            lex_block_sse2(p, &masks->blocks[i]);
+        else
+#endif
+            lex_block_scalar(p, &masks->blocks[i]);
+    }
+}
+
+enum { LEX_SPACE, LEX_NOT_SPACE, LEX_SQUOTE, LEX_DQUOTE };
+
+uint64_t lex_bits(const LexBlock* block, int kind) {
+    switch (kind) {
+        case LEX_SPACE: return block->space;
+        case LEX_NOT_SPACE: return ~block->space;
+        case LEX_SQUOTE: return block->squote;
+        default: return block->dquote;
+    }
+}
+
+// Index of the first byte at or after pos of the given kind, len if there is none
+size_t lex_next(const LexMasks* masks, int kind, size_t pos) {
+    while (pos < masks->len) {
+        size_t word = pos / 64;
+        uint64_t bits = lex_bits(&masks->blocks[word], kind);
+        bits &= ~(uint64_t)0 << (pos % 64);
+        if (bits != 0) {
+            size_t found = word * 64 + __builtin_ctzll(bits);
+            return found < masks->len ? found : masks->len;
+        }
+        pos = (word + 1) * 64;
+    }
+    return masks->len;
+}
+
+// Follows the quotes in str[start, end) so that in x='a && b' the && is
+// still inside the quote; returns the quote left open. A quote with no
+// matching one later in the line is a plain character, as in it's
+char lex_track_quotes(const LexMasks* masks, const char* str, size_t start, size_t end, char open) {
+    size_t pos = start;
+    while (pos < end) {
+        size_t single = lex_next(masks, LEX_SQUOTE, pos);
+        size_t dbl = lex_next(masks, LEX_DQUOTE, pos);
+        size_t quote = single < dbl ? single : dbl;
+        if (quote >= end)
+            break;
+        if (open == 0) {
+            if (lex_next(masks, str[quote] == '"' ? LEX_DQUOTE : LEX_SQUOTE, quote + 1) < masks->len)
+                open = str[quote];
+        } else if (str[quote] == open) {
+            open = 0;
+        }
+        pos = quote + 1;
+    }
+    return open;
+}
+
+// Splits a line into words on spaces, a word that starts with a quote runs to
+// the matching quote (which is dropped). Fills info when it is not NULL;
+// && / || / 2> inside quotes are not reported as operators, which does not
+// change where words start and end
+char** lex_split(const char* str, int* count, LexInfo* info) {
+    size_t len = strlen(str);
+    LexBlock stackBlocks[32];
+    LexMasks masks;
+    masks.blocks = len <= sizeof(stackBlocks) / sizeof(stackBlocks[0]) * 64 ? stackBlocks
+                   : (LexBlock*)malloc((len / 64 + 1) * sizeof(LexBlock));
+    if (masks.blocks == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    lex_classify(str, len, &masks);
+
+    // Word bounds first, so the result is allocated once
+    size_t stackBounds[2 * 64];
+    size_t* bounds = stackBounds;
+    int capacity = 64, tokens = 0;
+    int hasApos = 0, logicOp = -1, redirect = -1;
+    char open = 0;   // quote opened inside a word and not closed yet
+    for (size_t i = 0; i < masks.count; i++)
+        hasApos |= (masks.blocks[i].squote | masks.blocks[i].dquote) != 0;
+
+    size_t pos = lex_next(&masks, LEX_NOT_SPACE, 0);
+    while (pos < len) {
+        size_t word = pos, start = pos, end;
+        int quoted = str[pos] == '"' || str[pos] == '\'';
+        if (quoted) {
+            size_t close = lex_next(&masks, str[pos] == '"' ? LEX_DQUOTE : LEX_SQUOTE, pos + 1);
+            if (close < len) {
+                start = pos + 1;
+                end = close;
+                pos = close + 1;
+            } else {
+                end = pos = len;  // unterminated: keep the quote in the word
+            }
+            // A quoted word closes its own quote; inside an open one its bytes still count
+            if (open != 0)
+                open = lex_track_quotes(&masks, str, word, pos, open);
+        } else {
+            end = pos = lex_next(&masks, LEX_SPACE, pos);
+            // Operator words are only looked at when their first byte is one
+            size_t first = start / 64;
+            int opStart = (masks.blocks[first].op >> (start % 64)) & 1;
+            if (end - start == 2 && open == 0 && (opStart || str[start] == '2')) {
+                if ((str[start] == '&' || str[start] == '|') && str[start + 1] == str[start] && logicOp == -1)
+                    logicOp = tokens;
+                else if (str[start] == '2' && str[start + 1] == '>' && redirect == -1)
+                    redirect = tokens;
+            }
+            if (hasApos)
+                open = lex_track_quotes(&masks, str, start, end, open);
+        }
+        if (tokens == capacity) {
+            capacity *= 2;
+            size_t* grown = (size_t*)malloc(2 * capacity * sizeof(size_t));
+            if (grown == NULL) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(grown, bounds, 2 * tokens * sizeof(size_t));
+            if (bounds != stackBounds)
+                free(bounds);
+            bounds = grown;
+        }
+        bounds[2 * tokens] = start;
+        bounds[2 * tokens + 1] = end;
+        tokens++;
+        pos = lex_next(&masks, LEX_NOT_SPACE, pos);
+    }
+
+    char** result = (char**)malloc((tokens + 1) * sizeof(char*));
+    if (result == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < tokens; i++) {
+        result[i] = strndup(str + bounds[2 * i], bounds[2 * i + 1] - bounds[2 * i]);
+        if (result[i] == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    result[tokens] = NULL;
+    if (bounds != stackBounds)
+        free(bounds);
+    if (masks.blocks != stackBlocks)
+        free(masks.blocks);
+
+    if (count != NULL)
+        *count = tokens;
+    if (info != NULL) {
+        info->hasApos = hasApos;
+        info->logicOp = logicOp;
+        info->redirect = redirect;
+    }
+    return result;
+}
+
+// Command server. --serve SOCKET listens on a UNIX socket and forks one
+// session per client: the session inherits the alias table and variables
+// copy-on-write and starts with fresh counters and an empty job list, so
+// clients run side by side without seeing each other. A session reads
+// command lines from the socket and sends back the commands' output
+// followed by a status frame per line: an ASCII RS (0x1e), the exit status
+// and a newline.
+#define SERVE_FRAME '\036'
+
+int serveSession = 0;   // this process is a session of a --serve shell
+volatile sig_atomic_t serveStop = 0;
+
+void serve_stop(int sig) {
+    (void)sig;
+    serveStop = 1;
+}
+
+// Runs the accept loop; returns only in a session, with stdio on the client
+void serve_sessions(const char* path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERR\n");
+        exit(EXIT_FAILURE);
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener == -1) {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);   // a socket left behind by an earlier server
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(listener, 64) == -1) {
+        perror("bind");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "serving on %s\n", path);
+
+    // SIGINT/SIGTERM interrupt accept, so the socket and status page are removed on the way out
+    struct sigaction stop;
+    memset(&stop, 0, sizeof(stop));
+    stop.sa_handler = serve_stop;
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+    while (1) {
+        int conn = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (serveStop) {
+            unlink(path);
+            exit(0);
+        }
+        if (conn == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("accept");
+            exit(EXIT_FAILURE);
+        }
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("fork");
+            close(conn);
+            continue;
+        }
+        if (pid > 0) {
+            close(conn);
+            continue;
+        }
+
+        // Session: the client becomes stdin, stdout and stderr
+        close(listener);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        io_fork_child();
+        if (dup2(conn, STDIN_FILENO) == -1 || dup2(conn, STDOUT_FILENO) == -1 || dup2(conn, STDERR_FILENO) == -1) {
+            perror("dup2");
+            _exit(EXIT_FAILURE);
+        }
+        close(conn);
+        setvbuf(stdout, NULL, _IOLBF, 0);
+        status_detach();
+        status_open();   // each session shows up as a shell of its own
+        serveSession = 1;
+        return;
+    }
+}
+
+// Ends the client's current line with its status frame
+void serve_frame() {
+    printf("%c%d\n", SERVE_FRAME, lastExitStatus);
+    fflush(stdout);
+}
+
+// Session recording. --record FILE logs every input line with its arrival
+// time, duration and exit status; --replay FILE feeds such a log back as the
+// shell's input, as fast as possible or with --pace at the recorded arrival
+// times, and reports how the timings compare. The log is text: a header,
+// then one "arrival_ns<TAB>duration_ns<TAB>status<TAB>line" per line.
+#define RECORD_HEADER "# minishell record 1"
+
+FILE* recordOut = NULL;
+int64_t recordBase = 0;
+
+typedef struct ReplayLine {
+    int64_t arrival;     // ns since the recording started
+    int64_t duration;
+    int status;
+    char* line;
+    int64_t replayDuration;
+    int replayStatus;
+} ReplayLine;
+
+ReplayLine* replayLines = NULL;
+int replayCount = 0;
+int replayNext = 0;      // next line to feed
+int replayPace = 0;      // 1 - wait for each line's recorded arrival time
+int64_t replayBase = 0;
+
+void record_open(const char* path) {
+    recordOut = fopen(path, "we");
+    if (recordOut == NULL) {
+        perror("record");
+        return;
+    }
+    setvbuf(recordOut, NULL, _IOLBF, 0);  // a crash still leaves every finished line
+    recordBase = now_ns(CLOCK_MONOTONIC);
+    fprintf(recordOut, "%s\t%lld\n", RECORD_HEADER, (long long)now_ns(CLOCK_REALTIME));
+}
+
+void record_line(const char* line, int64_t startClock, int64_t duration, int status) {
+    if (recordOut != NULL)
+        fprintf(recordOut, "%lld\t%lld\t%d\t%s\n", (long long)(startClock - recordBase), (long long)duration, status,
+                line);
+}
+
+// Loads a recording; returns 0 if it cannot be read
+int replay_open(const char* path) {
+    FILE* file = fopen(path, "re");
+    if (file == NULL) {
+        perror("replay");
+        return 0;
+    }
+    char buf[1200];
+    if (fgets(buf, sizeof(buf), file) == NULL || strncmp(buf, RECORD_HEADER, strlen(RECORD_HEADER)) != 0) {
+        fclose(file);
+        return 0;
+    }
+    int cap = 0;
+    while (fgets(buf, sizeof(buf), file) != NULL) {
+        long long arrival, duration;
+        int status, offset;
+        if (sscanf(buf, "%lld\t%lld\t%d\t%n", &arrival, &duration, &status, &offset) != 3)
+            continue;
+        buf[strcspn(buf, "\n")] = '\0';
+        if (replayCount == cap) {
+            cap = cap ? cap * 2 : 256;
+            replayLines = (ReplayLine*)realloc(replayLines, cap * sizeof(ReplayLine));
+            if (replayLines == NULL) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        ReplayLine* entry = &replayLines[replayCount++];
+        entry->arrival = arrival;
+        entry->duration = duration;
+        entry->status = status;
+        entry->line = strdup(buf + offset);
+        entry->replayDuration = -1;
+        entry->replayStatus = 0;
+        if (entry->line == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    fclose(file);
+    replayBase = now_ns(CLOCK_MONOTONIC);
+    return 1;
+}
+
+// Next input line from the recording; after the last one the shell is told to exit
+void replay_next_line(char* input, size_t size) {
+    if (replayNext >= replayCount) {
+        snprintf(input, size, "exit_shell\n");
+        return;
+    }
+    ReplayLine* entry = &replayLines[replayNext++];
+    if (replayPace) {
+        int64_t wait = replayBase + entry->arrival - now_ns(CLOCK_MONOTONIC);
+        if (wait > 0) {
+            struct timespec ts = { wait / 1000000000, wait % 1000000000 };
+            while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+                ;
+        }
+    }
+    snprintf(input, size, "%s\n", entry->line);
+}
+
+void replay_result(int64_t duration, int status) {
+    if (replayLines != NULL && replayNext > 0 && replayLines[replayNext - 1].replayDuration < 0) {
+        replayLines[replayNext - 1].replayDuration = duration;
+        replayLines[replayNext - 1].replayStatus = status;
+    }
+}
 
-void sigHandler(int sig) {
-    pid_t pid;
-    int status;
+int compare_slowdown(const void* a, const void* b) {
+    const ReplayLine* x = *(const ReplayLine* const*)a;
+    const ReplayLine* y = *(const ReplayLine* const*)b;
+    int64_t dx = x->replayDuration - x->duration, dy = y->replayDuration - y->duration;
+    return dx < dy ? 1 : dx > dy ? -1 : 0;
+}
 
-    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-            // Check if pid is in job_list
-            Job* current = job_list;
-            while (current != NULL)
-            {
-                if (current->pid == pid) {
-                    succeededCMD++;
-                    // remove_job(pid);
-                    break;
-                }
-                current = current->next;
-            }
-        }
-        remove_job(pid);
+// Recorded against replayed timings, on stderr so it stays apart from the commands' output
+void replay_report() {
+    if (replayLines == NULL)
+        return;
+    int64_t recorded = 0, replayed = 0;
+    int ran = 0, mismatched = 0;
+    ReplayLine** order = (ReplayLine**)malloc((replayCount + 1) * sizeof(ReplayLine*));
+    if (order == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < replayCount; i++) {
+        ReplayLine* entry = &replayLines[i];
+        if (entry->replayDuration < 0)
+            continue;
+        recorded += entry->duration;
+        replayed += entry->replayDuration;
+        if (entry->replayStatus != entry->status)
+            mismatched++;
+        order[ran++] = entry;
+    }
+    fprintf(stderr, "replay: %d of %d lines%s, recorded %.3fs, replayed %.3fs (%+.1f%%), %d exit status mismatches\n",
+            ran, replayCount, replayPace ? " at recorded pace" : "", recorded / 1e9, replayed / 1e9,
+            recorded > 0 ? 100.0 * (replayed - recorded) / recorded : 0.0, mismatched);
+    qsort(order, ran, sizeof(ReplayLine*), compare_slowdown);
+    fprintf(stderr, "%12s %12s %10s %8s  %s\n", "recorded", "replayed", "delta", "status", "line");
+    for (int i = 0; i < ran && i < 10; i++) {
+        ReplayLine* entry = order[i];
+        char status[24];
+        if (entry->replayStatus == entry->status)
+            snprintf(status, sizeof(status), "%d", entry->status);
+        else
+            snprintf(status, sizeof(status), "%d->%d", entry->status, entry->replayStatus);
+        fprintf(stderr, "%10.3fms %10.3fms %+8.3fms %8s  %s\n", entry->duration / 1e6, entry->replayDuration / 1e6,
+                (entry->replayDuration - entry->duration) / 1e6, status, entry->line);
+    }
+    for (int i = 0; i < ran; i++) {
+        if (order[i]->replayStatus != order[i]->status && i >= 10)
+            fprintf(stderr, "status %d->%d: %s\n", order[i]->status, order[i]->replayStatus, order[i]->line);
     }
+    free(order);
+}
+
+// Bookkeeping once a line has run: history, the recording and the replay comparison
+void finish_line(const char* line, int64_t startTime, int64_t startClock) {
+    int64_t duration = now_ns(CLOCK_MONOTONIC) - startClock;
+    history_append(line, startTime, duration, lastExitStatus);
+    record_line(line, startClock, duration, lastExitStatus);
+    replay_result(duration, lastExitStatus);
 }
-int main() {
+
+int main(int argc, char* argv[]) {
     Dictionary dict;
+    lex_init();
     initDictionary(&dict);
+    open_aliases(&dict);
+    init_variables();
+    status_open();
+
+    // --io=stdio|epoll|uring (or $MINISHELL_IO) selects the I/O backend
+    const char* ioName = getenv("MINISHELL_IO");
+    const char* servePath = NULL;
+    const char* restorePath = NULL;
+    const char* replayPath = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--io=", 5) == 0)
+            ioName = argv[i] + 5;
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+            servePath = argv[++i];
+        else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc)
+            restorePath = argv[++i];
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            record_open(argv[++i]);
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            replayPath = argv[++i];
+        else if (strcmp(argv[i], "--pace") == 0)
+            replayPace = 1;
+    }
+    if (replayPath != NULL && !replay_open(replayPath)) {
+        fprintf(stderr, "ERR\n");
+        exit(EXIT_FAILURE);
+    }
+    io_init(ioName);
+    if (servePath != NULL) {
+        signal(SIGCHLD, sigHandler);  // reaps finished sessions
+        serve_sessions(servePath);
+    }
+    LineReader* stdinReader = ioBackend != IO_STDIO ? reader_open(STDIN_FILENO) : NULL;
 
     int aposCounter = 0;
     int scriptLine = 0,activeAlias;
+    scriptLineCounter = &scriptLine;
 
     int prevDupVal = -1;
 
@@ -273,18 +6199,75 @@ int main() {
     char input[1024];
 
     signal( SIGCHLD,sigHandler);
+    if (restorePath != NULL && !restore_checkpoint(restorePath, &dict, &scriptLine, &aposCounter))
+        fprintf(stderr, "ERR\n");
 
+    char line[1024];
+    int firstPrompt = 1;
+    int framePending = 0;
+    // Raw-mode editing only when both ends are a terminal
+    const char* term = getenv("TERM");
+    int interactive = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO) && !(term != NULL && strcmp(term, "dumb") == 0);
     while (1) {
-        activeAlias = dict.count;
+        check_adopted();
+        alias_shm_sync();
+        activeAlias = alias_count(&dict);
+        status_update(succeededCMD, lastExitStatus, scriptLine, activeAlias);
+        report_limit_violations();
+        if (firstPrompt && isatty(STDIN_FILENO)) {
+            // Interactive: build the completion index while the user types the first line
+            refresh_completion(0);
+            firstPrompt = 0;
+        }
 
         //prompt
-        printf("#cmd:%d|#alias:%d|#script lines:%d> ", succeededCMD, activeAlias, scriptLine);
+        char prompt[128];
+        snprintf(prompt, sizeof(prompt), "#cmd:%d|#alias:%d|#script lines:%d> ", succeededCMD, activeAlias, scriptLine);
 
-        if (fgets(input, sizeof(input), stdin) == NULL) {
+        // The line editor appends the newline fgets would have kept, so both paths look alike below
+        int got;
+        if (replayPath != NULL) {
+            printf("%s", prompt);
+            replay_next_line(input, sizeof(input));
+            got = 1;
+        } else if (serveSession) {
+            // Sessions get a status frame where the prompt would be
+            if (framePending)
+                serve_frame();
+            framePending = 1;
+            got = fgets(input, sizeof(input), stdin) != NULL;
+        } else if (interactive) {
+            got = editor_read_line(prompt, input, sizeof(input) - 1, &dict);
+            if (got == 1) {
+                strcat(input, "\n");
+            } else if (got == -1) {
+                // The terminal refused raw mode: read it cooked from now on
+                interactive = 0;
+                printf("%s", prompt);
+                fflush(stdout);
+                got = fgets(input, sizeof(input), stdin) != NULL;
+            }
+        } else if (stdinReader != NULL) {
+            printf("%s", prompt);
+            got = reader_next_line(stdinReader, input, sizeof(input));
+        } else {
+            printf("%s", prompt);
+            got = fgets(input, sizeof(input), stdin) != NULL;
+        }
+        if (got == 0 && serveSession) {
+            // The client hung up; its alias changes die with the session
+            fflush(stdout);
+            exit(0);
+        }
+        if (got == 0) {
             //printf("Error reading input or end-of-file reached.\n");
+            io_shutdown();
             fprintf(stderr, "ERR\n");
+            if (aliasDirty)
+                save_alias_snapshot(&dict);
             exit(1);
         }
+        ioCommands++;
 
         if (strlen(input) >= 1024) {
             //printf("more than 1024 chars\n");
@@ -300,17 +6283,32 @@ int main() {
 //        if (strcmp(input, "") == 0)
 //            continue;
 
+        strcpy(line, input);
+        int64_t startTime = now_ns(CLOCK_REALTIME);
+        int64_t startClock = now_ns(CLOCK_MONOTONIC);
+
         if (strcmp(input, "exit_shell") == 0) {
             //printf("Exiting_shell.\n");
             printf("%d\n", aposCounter);
+            replay_report();
+            report_limit_violations();
+            trace_stop();
+            cgroup_cleanup();
+            if (aliasDirty && !serveSession)
+                save_alias_snapshot(&dict);
+            io_shutdown();
             break;
         }
 
         // Check for source command
         int count = 0;
-        char** arr = split_string(input, &count);
+        LexInfo lex;
+        char** arr = lex_split(input, &count, &lex);
 
-        char* fileName = check_redirect(arr,count);
+        // A compound line applies each 2> to its own item or group
+        char* fileName = NULL;
+        if (!is_compound(input) && lex.redirect >= 0 && lex.redirect + 1 < count)
+            fileName = arr[lex.redirect + 1];
         if( fileName!= NULL){
             redirect_stderr(fileName, &prevDupVal);
             char* tempCommand = separate_befor_2arrow(arr);
@@ -344,8 +6342,12 @@ int main() {
 //        }
 
         if ((isExist(&dict, arr[0]) && strcmp(searchNode(&dict, arr[0]) , "source") == 0) || strcmp("source", arr[0]) == 0) {
-            execute_source_script(arr[1], &dict, &scriptLine, &aposCounter);
+            if (count > 1 && strcmp(arr[1], "--profile") == 0)
+                execute_profiled_script(arr, count, &dict, &scriptLine, &aposCounter);
+            else
+                execute_source_script(arr[1], &dict, &scriptLine, &aposCounter);
             free_split_string(arr);
+            finish_line(line, startTime, startClock);
 
             continue;
         }
@@ -353,119 +6355,16 @@ int main() {
         // Execute general commands
         execute_general(input, &dict, &aposCounter);
         free_split_string(arr);
+        finish_line(line, startTime, startClock);
     }
 
     freeDictionary(&dict);
     return 0;
 }
 
-// Checks if a string contains an apostrophe
-int hasApos(char* str){
-    char* ptr = str;
-    while(*ptr){
-        if(*ptr == '"' || *ptr == '\'')
-            return 1;
-        ptr++;
-    }
-    return 0;
-}
-
-
 // Splits a string into an array of strings based on spaces
 char** split_string(const char *str, int *count) {
-    // Count the number of tokens
-    int token_count = 0;
-    const char *ptr = str;
-    while (*ptr) {
-        while (*ptr && *ptr == ' ') {
-            ptr++; // Skip spaces
-        }
-        if (*ptr) {
-            token_count++;
-            // Check for quoted strings
-            if (*ptr == '"' || *ptr == '\'') {
-                char quote = *ptr;
-                ptr++;
-                while (*ptr && *ptr != quote) {
-                    ptr++;
-                }
-                if (*ptr) {
-                    ptr++; // Skip closing quote
-                }
-            } else {
-                while (*ptr && *ptr != ' ') {
-                    ptr++; // Skip non-spaces
-                }
-            }
-        }
-    }
-
-    // Allocate memory for the array of strings
-    char **result = (char **)malloc((token_count + 1) * sizeof(char*));
-    if (result == NULL) {
-        perror("malloc");
-        exit(EXIT_FAILURE);
-    }
-
-    // Split the string and fill the array
-    ptr = str;
-    int i = 0;
-    while (*ptr != '\0') {
-        while (*ptr && *ptr == ' ') {
-            ptr++; // Skip spaces
-        }
-        if (*ptr != '\0') {
-            const char *start = ptr;
-            size_t length;
-            if (*ptr == '"' || *ptr == '\'') {
-                char quote = *ptr;
-                ptr++;
-                start = ptr; //update the start position to start after the first quote
-                while (*ptr && *ptr != quote) {
-                    ptr++;
-                }
-                if(*ptr == quote)
-                    length = ptr - start; // update length of the argument in side the quotes
-                else{
-                    start--;
-                    length = ptr - start;
-//                    printf("ERR\n");              /** ????????????????????????????????????? */
-//                    free_split_string(result);    /** ????????????????????????????????????? */
-//                    return NULL;                  /** ????????????????????????????????????? */
-                }
-                if (*ptr) {
-                    ptr++; // Skip closing quote
-                }
-            }
-            else {
-                while (*ptr && *ptr != ' ') {
-                    ptr++; // Move to the end of the substring
-                }
-                length = ptr - start;
-            }
-
-            result[i] = (char *)malloc((length + 1) * sizeof(char));
-            if (result[i] == NULL) {
-                perror("malloc");
-                // Free previously allocated memory on error
-                for (int j = 0; j < i; j++) {
-                    free(result[j]);
-                }
-                free(result);
-                exit(EXIT_FAILURE);
-            }
-            strncpy(result[i], start, length); // Copy the substring
-            result[i][length] = '\0'; // Null-terminate the string
-            i++;
-        }
-    }
-    result[token_count] = NULL; // Null-terminate the array
-
-    // Set the count if the caller provided a pointer for it
-    if (count != NULL) {
-        *count = token_count;
-    }
-    return result;
+    return lex_split(str, count, NULL);
 }
 
 // Function to free the array of strings
@@ -563,23 +6462,9 @@ int checkForAlias(char* input, Dictionary* dict){
         temp[counter] = '\0';
         shortCut[countShcut] = '\0';
 
-        int countCheck =0;
-        char **checking = split_string(temp,&countCheck);
-
-        if( ( strcmp(checking[0] , "echo") != 0)  && countCheck >4 ) {
-            //printf("try creating shortcut to more than 4 arguments\n");
-            fprintf(stderr, "ERR\n");
-            // Free the allocated memory
-            free(temp);
-            free(shortCut);
-            free_split_string(checking);
-            return 0 ; // Do not exit, just return to continue the shell operation
-//            exit(1);
-        }
         addNode(dict, shortCut, temp);
         free(temp); // Freeing temp as addNode duplicates it
         free(shortCut);
-        free_split_string(checking);
     }
     else if (strncmp("unalias" , input , 7) == 0){
         char rem [50];
@@ -590,57 +6475,486 @@ int checkForAlias(char* input, Dictionary* dict){
         rem[j]='\0';
         removeNode(dict,rem);
     }
-    return 1;
-}
-
-void execute_general(char* input ,Dictionary* dict, int *aposCounter){
-    int count;
-//    int backgroundThreadsCounter = 0;
-    char strInput[1024];
+    return 1;
+}
+
+// Script read-ahead. While a foreground child of a sourced script runs, the
+// shell reads the next lines and tokenizes, alias-expands and path-resolves
+// them, so that work overlaps the child instead of following its wait. Each
+// prepared line records the alias and PATH generations it was built against
+// and is rebuilt from scratch if either moved before it runs. Lines whose
+// meaning depends on state the previous commands may change ($ expansion,
+// globs, lists, && / ||, 2>, background jobs) are only read, not prepared.
+#define READAHEAD_MAX 64
+
+typedef struct AheadLine {
+    char text[1024];        // as read, newline included
+    int prepared;           // arr and aliasArr below are owned by this slot
+    char** arr;
+    int count;
+    LexInfo lex;
+    char** aliasArr;        // the alias's words, NULL if arr[0] is not an alias
+    int aliasCount;
+    unsigned long aliasGen;
+    unsigned long pathGen;
+} AheadLine;
+
+typedef struct ScriptAhead {
+    FILE* file;
+    LineReader* reader;
+    AheadLine lines[READAHEAD_MAX];
+    int head;               // oldest line not yet handed to the script loop
+    int count;
+    int eof;
+    AheadLine* current;     // slot of the line the loop is running
+} ScriptAhead;
+
+ScriptAhead* activeAhead = NULL;
+AheadLine* readyLine = NULL;    // prepared form of the line about to be run
+int readaheadDepth = -1;        // $MINISHELL_READAHEAD, 8 by default; 0 turns it off
+
+int ahead_depth() {
+    if (readaheadDepth < 0) {
+        const char* env = getenv("MINISHELL_READAHEAD");
+        readaheadDepth = env != NULL ? atoi(env) : 8;
+        if (readaheadDepth < 0)
+            readaheadDepth = 0;
+        if (readaheadDepth > READAHEAD_MAX)
+            readaheadDepth = READAHEAD_MAX;
+    }
+    return readaheadDepth;
+}
+
+void ahead_release(AheadLine* entry) {
+    if (!entry->prepared)
+        return;
+    free_split_string(entry->arr);
+    free_split_string(entry->aliasArr);
+    entry->prepared = 0;
+}
+
+int is_builtin_name(const char* name) {
+    for (int i = 0; i < BUILTIN_COUNT; i++) {
+        if (strcmp(name, builtinNames[i]) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// Does what execute_general would do first for a plain command line
+void ahead_prepare(AheadLine* entry, const Dictionary* dict) {
+    char line[1024];
+    strcpy(line, entry->text);
+    line[strcspn(line, "\n")] = '\0';
+    size_t len = strlen(line);
+    if (len == 0 || line[0] == '#' || line[len - 1] == '&' || strchr(line, '$') != NULL || has_glob_chars(line) ||
+        is_compound(line))
+        return;
+    entry->arr = lex_split(line, &entry->count, &entry->lex);
+    if (entry->count == 0 || entry->lex.logicOp >= 0 || entry->lex.redirect >= 0) {
+        free_split_string(entry->arr);
+        return;
+    }
+    alias_shm_sync();
+    entry->aliasGen = aliasGeneration;
+    entry->pathGen = pathGeneration;
+    entry->aliasArr = NULL;
+    entry->aliasCount = 0;
+    const char* command = entry->arr[0];
+    if (isExist(dict, entry->arr[0])) {
+        entry->aliasArr = split_string(searchNode(dict, entry->arr[0]), &entry->aliasCount);
+        command = entry->aliasCount > 0 ? entry->aliasArr[0] : NULL;
+    }
+    if (command != NULL && !is_builtin_name(command))
+        command_path(command);   // warms the path cache
+    entry->prepared = 1;
+    aheadPrepared++;
+}
+
+int ahead_read(ScriptAhead* ahead, char* line, size_t size) {
+    if (ahead->eof)
+        return 0;
+    int got = ahead->file != NULL ? fgets(line, size, ahead->file) != NULL : reader_next_line(ahead->reader, line, size);
+    if (!got)
+        ahead->eof = 1;
+    return got;
+}
+
+// Reads and prepares lines up to the read-ahead depth; called while a foreground child runs
+void readahead_fill(const Dictionary* dict) {
+    ScriptAhead* ahead = activeAhead;
+    if (ahead == NULL)
+        return;
+    int64_t spanStart = trace_now();
+    while (ahead->count < readaheadDepth && !ahead->eof) {
+        AheadLine* entry = &ahead->lines[(ahead->head + ahead->count) % READAHEAD_MAX];
+        if (entry == ahead->current)
+            break;   // still in use by the running line
+        ahead_release(entry);
+        if (!ahead_read(ahead, entry->text, sizeof(entry->text)))
+            break;
+        ahead_prepare(entry, dict);
+        ahead->count++;
+    }
+    trace_span("readahead", spanStart, NULL);
+}
+
+// Next script line, from the read-ahead queue when there is one
+int ahead_next_line(ScriptAhead* ahead, char* line, size_t size) {
+    ahead->current = NULL;
+    if (ahead->count == 0) {
+        AheadLine* entry = &ahead->lines[ahead->head];
+        ahead_release(entry);
+        if (!ahead_read(ahead, entry->text, sizeof(entry->text)))
+            return 0;
+        ahead->count = 1;
+    }
+    AheadLine* entry = &ahead->lines[ahead->head];
+    ahead->head = (ahead->head + 1) % READAHEAD_MAX;
+    ahead->count--;
+    ahead->current = entry;
+    snprintf(line, size, "%s", entry->text);
+    return 1;
+}
+
+// Hands the prepared form of input to execute_general, if it is still valid
+AheadLine* take_ready_line(const char* input) {
+    AheadLine* entry = readyLine;
+    readyLine = NULL;
+    if (entry == NULL || !entry->prepared)
+        return NULL;
+    size_t len = strlen(input);
+    if (strncmp(entry->text, input, len) != 0 || (entry->text[len] != '\n' && entry->text[len] != '\0'))
+        return NULL;
+    alias_shm_sync();
+    if (entry->aliasGen != aliasGeneration || entry->pathGen != pathGeneration) {
+        ahead_release(entry);
+        aheadDiscarded++;
+        return NULL;
+    }
+    entry->prepared = 0;   // execute_general owns the words now
+    aheadUsed++;
+    return entry;
+}
+
+void execute_general(char* input ,Dictionary* dict, int *aposCounter){
+    int count;
+//    int backgroundThreadsCounter = 0;
+    char strInput[1024];
+
+    trace_jobs();
+
+    // Lists with ;, subshells and brace groups have their own executor
+    if (is_compound(input)) {
+        int64_t listStart = trace_now();
+        run_list(input, dict, aposCounter);
+        trace_span("list", listStart, input);
+        return;
+    }
+
+    /**
+     * check if the command end with & and deal with it in the parent process
+     */
+    int background = 0;
+    if (input[0] == '\0')
+        return;  // e.g. an empty side of && / ||
+    if(input[strlen(input)-1] == '&'){
+        background = 1;
+        strcpy(strInput, input);
+//        backgroundThreadsCounter++;
+        input[strlen(input)-1] = '\0';
+    }
+
+    int64_t spanStart = trace_now();
+    LexInfo lex;
+    char** arr;
+    char** readyAlias = NULL;
+    int readyAliasCount = 0;
+    AheadLine* ready = background ? NULL : take_ready_line(input);
+    if (ready != NULL) {
+        // Tokenized and alias-expanded by the read-ahead while the previous line ran
+        arr = ready->arr;
+        count = ready->count;
+        lex = ready->lex;
+        readyAlias = ready->aliasArr;
+        readyAliasCount = ready->aliasCount;
+    } else {
+        arr = lex_split(input, &count, &lex);
+    }
+    trace_span("tokenize", spanStart, NULL);
+
+    // check for 2> operator and handle it in separate function
+
+    //char* fileName = check_redirect(arr,count);
+
+    /*if( fileName!= NULL){
+        redirect_stderr(fileName, prevDupVal);
+        char* tempCommand = separate_befor_2arrow(arr);
+        free_split_string(arr);
+        arr = split_string(tempCommand,&count);
+        free(tempCommand);
+    }
+    else{
+        if(dup2((*prevDupVal), STDERR_FILENO) == -1){
+            perror("dup2");
+            exit(1);
+        }
+    }*/
+
+    if(strcmp(input, "jobs")==0){
+        succeededCMD++;
+        lastExitStatus = 0;
+        print_jobs();
+        free_split_string(arr);
+        return;
+    }
+
+    if (count > 1 && strcmp(arr[0], "jobs") == 0 && strcmp(arr[1], "-c") == 0) {
+        lastExitStatus = 1;
+        if (print_ledger(arr, count) == 1) {
+            succeededCMD++;
+            lastExitStatus = 0;
+        }
+        free_split_string(arr);
+        return;
+    }
+
+    if (count > 1 && strcmp(arr[0], "jobs") == 0 && strcmp(arr[1], "-o") == 0) {
+        lastExitStatus = 1;
+        if (print_capture(arr, count) == 1) {
+            succeededCMD++;
+            lastExitStatus = 0;
+        }
+        free_split_string(arr);
+        return;
+    }
+
+    if (count > 0 && strcmp(arr[0], "capture") == 0) {
+        lastExitStatus = 1;
+        if (handle_capture(arr, count) == 1) {
+            succeededCMD++;
+            lastExitStatus = 0;
+        }
+        free_split_string(arr);
+        return;
+    }
+
+    // NAME=value lines are taken before the && / || split and before $
+    // expansion: quoted values and expanded text stay inside the value
+    if (!background && count > 0 && assignment_name(arr[0]) > 0 && handle_assignments(input)) {
+        succeededCMD++;
+        lastExitStatus = 0;
+        free_split_string(arr);
+        return;
+    }
+
+    // Split on && / || before the builtins below so each side runs on its own
+    if (count > 0 && lex.logicOp >= 0) {
+        spanStart = trace_now();
+        execute_logical_operator(arr, dict, count, aposCounter);
+        trace_span("logic", spanStart, input);
+        free_split_string(arr);
+        return;
+    }
+
+    // Expand $NAME / ${NAME} / $? before anything looks at the words; the
+    // expanded words are never taken for && / || again
+    char expanded[1024];
+    const char* typed = input;
+    if (strchr(input, '$') != NULL) {
+        spanStart = trace_now();
+        if (expand_variables(input, expanded, sizeof(expanded)) == -1) {
+            lastExitStatus = 1;
+            fprintf(stderr, "ERR\n");
+            free_split_string(arr);
+            return;
+        }
+        input = expanded;
+        free_split_string(arr);
+        arr = lex_split(input, &count, &lex);
+        trace_span("expand", spanStart, NULL);
+        if (count == 0) {
+            succeededCMD++;
+            lastExitStatus = 0;
+            free_split_string(arr);
+            return;
+        }
+    }
+
+    // Filename globbing (alias definitions keep their patterns for later)
+    if (has_glob_chars(input) && strcmp(arr[0], "alias") != 0 && strcmp(arr[0], "unalias") != 0) {
+        spanStart = trace_now();
+        arr = expand_globs(input, arr, &count);
+        trace_span("glob", spanStart, NULL);
+        if (count == 0) {
+            succeededCMD++;
+            lastExitStatus = 0;
+            free_split_string(arr);
+            return;
+        }
+    }
+
+    if (strcmp(arr[0], "shopt") == 0) {
+        lastExitStatus = 1;
+        if (handle_shopt(arr, count) == 1) {
+            succeededCMD++;
+            lastExitStatus = 0;
+        }
+        free_split_string(arr);
+        return;
+    }
+
+    if (strcmp(arr[0], "export") == 0 || strcmp(arr[0], "unset") == 0) {
+        lastExitStatus = 1;
+        if (handle_export(arr, count) == 1) {
+            succeededCMD++;
+            lastExitStatus = 0;
+        }
+        free_split_string(arr);
+        return;
+    }
+
+    if (count > 0 && strcmp(arr[0], "affinity") == 0) {
+        lastExitStatus = 1;
+        if (handle_affinity(arr, count) == 1) {
+            succeededCMD++;
+            lastExitStatus = 0;
+        }
+        free_split_string(arr);
+        return;
+    }
+
+    // wait: the awaited jobs' own successes already counted in job_finished
+    if (count > 0 && strcmp(arr[0], "wait") == 0) {
+        int before = succeededCMD;
+        spanStart = trace_now();
+        if (handle_wait(arr, count) == 1 && succeededCMD == before)
+            succeededCMD++;
+        trace_span("wait", spanStart, input);
+        free_split_string(arr);
+        return;
+    }
+
+    // complete [-t] PREFIX: list the command names the line editor would offer
+    if (count > 0 && strcmp(arr[0], "complete") == 0) {
+        int timed = count > 1 && strcmp(arr[1], "-t") == 0;
+        if (count != 2 + timed) {
+            lastExitStatus = 1;
+            fprintf(stderr, "ERR\n");
+            free_split_string(arr);
+            return;
+        }
+        int64_t start = now_ns(CLOCK_MONOTONIC);
+        int matchCount;
+        char** matches = complete_command(dict, arr[1 + timed], &matchCount);
+        int64_t elapsed = now_ns(CLOCK_MONOTONIC) - start;
+        if (timed) {
+            printf("%d matches in %.1f us\n", matchCount, elapsed / 1e3);
+        } else {
+            for (int i = 0; i < matchCount; i++)
+                printf("%s\n", matches[i]);
+        }
+        free_split_string(matches);
+        succeededCMD++;
+        lastExitStatus = 0;
+        free_split_string(arr);
+        return;
+    }
 
-    /**
-     * check if the command end with & and deal with it in the parent process
-     */
-    int background = 0;
-    if(input[strlen(input)-1] == '&'){
-        background = 1;
-        strcpy(strInput, input);
-//        backgroundThreadsCounter++;
-        input[strlen(input)-1] = '\0';
+    if (count > 0 && strcmp(arr[0], "trace") == 0) {
+        lastExitStatus = 1;
+        if (handle_trace(arr, count) == 1) {
+            succeededCMD++;
+            lastExitStatus = 0;
+        }
+        free_split_string(arr);
+        return;
     }
 
-    char** arr = split_string(input,&count);
+    if (count == 1 && strcmp(arr[0], "memstats") == 0) {
+        print_memstats();
+        succeededCMD++;
+        lastExitStatus = 0;
+        free_split_string(arr);
+        return;
+    }
 
-    // check for 2> operator and handle it in separate function
+    if (count == 1 && strcmp(arr[0], "iostat") == 0) {
+        print_io_stats();
+        succeededCMD++;
+        lastExitStatus = 0;
+        free_split_string(arr);
+        return;
+    }
 
-    //char* fileName = check_redirect(arr,count);
+    // checkpoint saves the status of the line before it, so it is set afterwards
+    if (count > 0 && strcmp(arr[0], "checkpoint") == 0) {
+        if (handle_checkpoint(arr, count, dict, scriptLineCounter != NULL ? *scriptLineCounter : 0, *aposCounter) == 1) {
+            succeededCMD++;
+            lastExitStatus = 0;
+        } else {
+            lastExitStatus = 1;
+        }
+        free_split_string(arr);
+        return;
+    }
 
-    /*if( fileName!= NULL){
-        redirect_stderr(fileName, prevDupVal);
-        char* tempCommand = separate_befor_2arrow(arr);
+    if (count > 0 && strcmp(arr[0], "history") == 0) {
+        lastExitStatus = 1;
+        if (handle_history(arr, count) == 1) {
+            succeededCMD++;
+            lastExitStatus = 0;
+        }
         free_split_string(arr);
-        arr = split_string(tempCommand,&count);
-        free(tempCommand);
+        return;
     }
-    else{
-        if(dup2((*prevDupVal), STDERR_FILENO) == -1){
-            perror("dup2");
-            exit(1);
+
+    // limit prefix: run the rest of the line with the given resource limits
+    if (count > 0 && strcmp(arr[0], "limit") == 0) {
+        if (count == 1) {
+            print_limit_status();
+            succeededCMD++;
+            lastExitStatus = 0;
+            free_split_string(arr);
+            return;
         }
-    }*/
+        JobLimits limits;
+        int used = parse_limits(arr, count, &limits);
+        if (used < 0 || used >= count) {
+            lastExitStatus = 1;
+            fprintf(stderr, "ERR\n");
+            free_split_string(arr);
+            return;
+        }
+        // Skip the prefix words in the original text so quoting is kept and
+        // the rest is expanded only once, by the nested call
+        char rest[1024];
+        const char* ptr = background ? strInput : typed;
+        for (int i = 0; i < used; i++) {
+            while (*ptr == ' ')
+                ptr++;
+            while (*ptr && *ptr != ' ')
+                ptr++;
+        }
+        while (*ptr == ' ')
+            ptr++;
+        strcpy(rest, ptr);
 
-    if(strcmp(input, "jobs")==0){
-        succeededCMD++;
-        print_jobs();
+        JobLimits* prevLimits = activeLimits;
+        activeLimits = &limits;
+        execute_general(rest, dict, aposCounter);
+        activeLimits = prevLimits;
         free_split_string(arr);
         return;
     }
 
     // Check for alias / unalias
     if (strcmp("alias", arr[0]) == 0 || strcmp("unalias", arr[0]) == 0) {
+        lastExitStatus = 1;
         if (checkForAlias(input, dict) == 1) {
             succeededCMD++;
-            if (hasApos(input)) {
+            lastExitStatus = 0;
+            if (lex.hasApos) {
                 (*aposCounter)++;
             }
         }
@@ -649,64 +6963,80 @@ void execute_general(char* input ,Dictionary* dict, int *aposCounter){
         return;
     }
 
-    // Handle alias expansion
-    if (isExist(dict, arr[0])) {
-        char *aliasCommand = searchNode(dict, arr[0]);
+    // argv for exec: the words stay in arr (and in the alias's own split), no copies
+    ArgVector argv;
+    argv_init(&argv);
+    char** aliasArr = NULL;
+    if (ready != NULL ? readyAlias != NULL : isExist(dict, arr[0])) {
+        spanStart = trace_now();
 
-        // Split the alias command
-        int aliasCount;
-        char **aliasArr = split_string(aliasCommand, &aliasCount);
-
-        // Combine alias command with original arguments
-        char **newArr = (char **)malloc((aliasCount + count) * sizeof(char *));
-        if (newArr == NULL) {
-            //perror("Failed to allocate memory for newArr");
-            perror("malloc");
+        // The alias words followed by the original arguments, skipping the alias itself
+        int aliasCount = readyAliasCount;
+        aliasArr = readyAlias != NULL ? readyAlias : split_string(searchNode(dict, arr[0]), &aliasCount);
+        if (check_logic_op(aliasArr) == 1) {
+            // An alias holding && / ||: its text replaces the name in the line
+            // as typed and the result runs as a whole, so the alias's operators
+            // split it and the arguments are expanded once, inside their command
+            char line[1024];
+            const char* args = typed;
+            while (*args == ' ')
+                args++;
+            while (*args && *args != ' ')
+                args++;
+            int len = snprintf(line, sizeof(line), "%s%s", searchNode(dict, arr[0]), args);
             free_split_string(aliasArr);
             free_split_string(arr);
-            exit(EXIT_FAILURE);
-        }
-
-        // Copy alias command parts
-        for (int i = 0; i < aliasCount; i++) {
-            newArr[i] = strdup(aliasArr[i]);
-            if (newArr[i] == NULL) {
-//                perror("Failed to allocate memory for newArr element");
-                perror("malloc");
-                for (int j = 0; j < i; j++) free(newArr[j]);
-                free(newArr);
-                free_split_string(aliasArr);
-                free_split_string(arr);
-                exit(EXIT_FAILURE);
-            }
-        }
-
-        // Copy original arguments, skipping the alias itself
-        for (int i = 1; i < count; i++) {
-            newArr[aliasCount + i - 1] = strdup(arr[i]);
-            if (newArr[aliasCount + i - 1] == NULL) {
-//                perror("Failed to allocate memory for newArr element");
-                perror("malloc");
-                for (int j = 0; j < aliasCount + i - 1; j++) free(newArr[j]);
-                free(newArr);
-                free_split_string(aliasArr);
-                free_split_string(arr);
-                exit(EXIT_FAILURE);
+            argv_free(&argv);
+            trace_span("alias", spanStart, NULL);
+            if (len >= (int)sizeof(line)) {
+                lastExitStatus = 1;
+                fprintf(stderr, "ERR\n");
+                return;
             }
+            execute_general(line, dict, aposCounter);
+            return;
         }
-        newArr[aliasCount + count - 1] = NULL;
-
-
-        // Clean up old arrays
-        free_split_string(arr);
-        free_split_string(aliasArr);
-
-        arr = newArr;
-        count = aliasCount + count - 1;
+        argv_append(&argv, aliasArr, aliasCount);
+        argv_append(&argv, arr + 1, count - 1);
+        trace_span("alias", spanStart, argv.items[0]);
+    } else {
+        argv_append(&argv, arr, count);
+    }
+    if (argv.count == 0) {
+        // An alias that expands to nothing
+        succeededCMD++;
+        lastExitStatus = 0;
+    }
+    else if (!argv_fits(&argv)) {
+        // Would fail in execve with E2BIG
+        lastExitStatus = 126;
+        fprintf(stderr, "ERR\n");
     }
-    if(check_logic_op(arr) == 1)
-        execute_logical_operator(arr,dict,count,aposCounter);
     else{
+        // Background jobs get their core set before the fork so the child can apply it
+        cpu_set_t placement;
+        int placeCpu = -1, placeNode = -1;
+        int placed = background && choose_placement(&placement, &placeCpu, &placeNode);
+        JobLimits* limits = activeLimits;
+        int cgroupId = limits != NULL ? cgroup_create_job(limits, strInput) : 0;
+
+        // SIGCHLD stays blocked until the parent collected a foreground child,
+        // so the handler cannot reap it first
+        sigset_t block, prevMask;
+        sigemptyset(&block);
+        sigaddset(&block, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &block, &prevMask);
+        io_flush_output();
+        int captureFds[2];
+        int captured = background && capture_pipe(captureFds);
+        char** envp = shell_envp();
+        const char* execPath = command_path(argv.items[0]);
+        // While tracing, a close-on-exec pipe shows when the child's exec went through
+        int execFds[2] = { -1, -1 };
+        if (traceOut != NULL && pipe2(execFds, O_CLOEXEC) == -1)
+            execFds[0] = execFds[1] = -1;
+
+        spanStart = trace_now();
         pid_t pid = fork();
         int status;
         if (pid == -1) {
@@ -717,20 +7047,21 @@ void execute_general(char* input ,Dictionary* dict, int *aposCounter){
 
         if (pid == 0) {
             // Child process
+            sigprocmask(SIG_SETMASK, &prevMask, NULL);
+            if (execFds[0] != -1)
+                close(execFds[0]);
+            if (captured && (dup2(captureFds[1], STDOUT_FILENO) == -1 || dup2(captureFds[1], STDERR_FILENO) == -1))
+                perror("dup2");
 
-            // Check for command argument limits (except for 'echo')
-            if (strcmp(arr[0], "echo") != 0 && count >= 6) {
-//            printf("Error: command has more than 4 arguments\n");
-                //printf("ERR\n");
-
-                fprintf(stderr, "ERR\n");
-                free_split_string(arr);
-                //exit(1);
-                return;
-            }
+            if (placed && sched_setaffinity(0, sizeof(placement), &placement) == -1)
+                perror("sched_setaffinity");
+            if (limits != NULL)
+                apply_limits(limits, cgroupId);
 
             // Execute the command
-            execvp(arr[0], arr);
+            if (execPath != NULL)
+                execve(execPath, argv.items, envp);
+            execvpe(argv.items[0], argv.items, envp);
             // If execvp fails
 //        perror("execvp failed");
             perror("exec");
@@ -739,49 +7070,273 @@ void execute_general(char* input ,Dictionary* dict, int *aposCounter){
             _exit(EXIT_FAILURE);    //has to change to _exit instead exit
         }
         else {
+            trace_span("fork", spanStart, argv.items[0]);
+            if (execFds[0] != -1) {
+                // EOF once the exec replaced the child (or it exited on failure)
+                char byte;
+                close(execFds[1]);
+                spanStart = trace_now();
+                while (read(execFds[0], &byte, 1) == -1 && errno == EINTR)
+                    ;
+                close(execFds[0]);
+                trace_span("exec", spanStart, argv.items[0]);
+            }
             if(!background) {
                 // Parent process
-                waitpid(pid, &status, 0);
+                readahead_fill(dict);
+                spanStart = trace_now();
+                status_foreground(pid, input);
+                io_wait_child(pid, &status);
+                status_foreground(0, NULL);
+                trace_span("wait", spanStart, input);
+                sigprocmask(SIG_SETMASK, &prevMask, NULL);
+                lastExitStatus = decode_status(status);
                 if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
                     succeededCMD++;
-                    if (hasApos(input)) {
+                    if (lex.hasApos) {
                         (*aposCounter)++;
                     }
                 }
+                if (limits != NULL)
+                    check_limit_violation(0, input, status, limits, cgroupId);
             }
             else{
-                add_job(pid,strInput);
-                printf("[%d] %d\n", next_job_id-1, pid);
+                lastExitStatus = -1;
+                Job* job = add_job(pid,strInput);
+                if (placed) {
+                    job->placed = 1;
+                    job->placeCpu = placeCpu;
+                    job->placeNode = placeNode;
+                    job->placement = placement;
+                }
+                if (limits != NULL) {
+                    job->limited = 1;
+                    job->limits = *limits;
+                    job->cgroupId = cgroupId;
+                }
+                if (captured) {
+                    close(captureFds[1]);
+                    capture_start(captureFds[0], job->job_id, pid, strInput);
+                }
+                int jobId = job->job_id;  // the handler may free the job once SIGCHLD is unblocked
+                sigprocmask(SIG_SETMASK, &prevMask, NULL);
+                printf("[%d] %d\n", jobId, pid);
             }
             //printf("child process exit code: %d\n", WEXITSTATUS(status));
         }
 
     }
+    argv_free(&argv);
+    free_split_string(aliasArr);
     free_split_string(arr);
 }
 
+// Per-line profile of a sourced script (source --profile)
+typedef struct LineProfile {
+    int line;            // line number within the script
+    int ok;
+    int failed;
+    int64_t wallNs;
+    int64_t cpuNs;       // user + system time of the children the line waited for
+    char* text;
+} LineProfile;
+
+typedef struct ScriptProfile {
+    LineProfile* lines;
+    int count;
+    int capacity;
+} ScriptProfile;
+
+ScriptProfile* activeProfile = NULL;
+
+int64_t children_cpu_ns() {
+    struct rusage usage;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * (int64_t)1000000000 +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * (int64_t)1000;
+}
+
+void profile_record(ScriptProfile* profile, int line, const char* text, int ok, int64_t wallNs, int64_t cpuNs) {
+    if (profile->count == profile->capacity) {
+        profile->capacity = profile->capacity ? profile->capacity * 2 : 64;
+        profile->lines = (LineProfile*)realloc(profile->lines, profile->capacity * sizeof(LineProfile));
+        if (profile->lines == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    LineProfile* entry = &profile->lines[profile->count++];
+    entry->line = line;
+    entry->ok = ok;
+    entry->failed = !ok;
+    entry->wallNs = wallNs;
+    entry->cpuNs = cpuNs;
+    entry->text = strdup(text);
+    if (entry->text == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int compare_line_time(const void* a, const void* b) {
+    const LineProfile* x = (const LineProfile*)a;
+    const LineProfile* y = (const LineProfile*)b;
+    if (x->wallNs != y->wallNs)
+        return x->wallNs < y->wallNs ? 1 : -1;
+    return x->line - y->line;
+}
+
+// Wall time per line number from a profile saved with -o; -1 where the line is missing
+int64_t* load_profile(const char* path, int maxLine) {
+    FILE* in = fopen(path, "r");
+    if (in == NULL) {
+        perror(path);
+        return NULL;
+    }
+    int64_t* wall = (int64_t*)malloc((maxLine + 1) * sizeof(int64_t));
+    if (wall == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i <= maxLine; i++)
+        wall[i] = -1;
+    char row[1200];
+    while (fgets(row, sizeof(row), in) != NULL) {
+        int line;
+        long long us;
+        if (row[0] != '#' && sscanf(row, "%d\t%lld", &line, &us) == 2 && line >= 0 && line <= maxLine)
+            wall[line] = us * 1000;
+    }
+    fclose(in);
+    return wall;
+}
+
+// source --profile [-o FILE] [-c OLDFILE] [-n TOP] script.sh
+void execute_profiled_script(char** arr, int count, Dictionary* dict, int* scriptLine, int* aposCounter) {
+    const char* saveFile = NULL;
+    const char* compareFile = NULL;
+    int top = 10;
+    int i = 2;
+    for (; i + 1 < count && arr[i][0] == '-'; i += 2) {
+        if (strcmp(arr[i], "-o") == 0)
+            saveFile = arr[i + 1];
+        else if (strcmp(arr[i], "-c") == 0)
+            compareFile = arr[i + 1];
+        else if (strcmp(arr[i], "-n") == 0 && atoi(arr[i + 1]) > 0)
+            top = atoi(arr[i + 1]);
+        else
+            break;
+    }
+    if (i != count - 1) {
+        lastExitStatus = 1;
+        fprintf(stderr, "ERR\n");
+        return;
+    }
+
+    ScriptProfile profile = { NULL, 0, 0 };
+    activeProfile = &profile;
+    int64_t start = now_ns(CLOCK_MONOTONIC);
+    execute_source_script(arr[i], dict, scriptLine, aposCounter);
+    int64_t total = now_ns(CLOCK_MONOTONIC) - start;
+    activeProfile = NULL;
+    if (profile.count == 0 && lastExitStatus != 0)
+        return;  // the script could not be run
+
+    // Saved in line order, one tab-separated record per line, so two runs diff cleanly
+    if (saveFile != NULL) {
+        FILE* out = fopen(saveFile, "w");
+        if (out == NULL) {
+            perror(saveFile);
+        } else {
+            fprintf(out, "# line\twall_us\tcpu_us\tok\tfailed\tcommand\n");
+            for (int k = 0; k < profile.count; k++) {
+                LineProfile* entry = &profile.lines[k];
+                fprintf(out, "%d\t%lld\t%lld\t%d\t%d\t%s\n", entry->line, (long long)(entry->wallNs / 1000),
+                        (long long)(entry->cpuNs / 1000), entry->ok, entry->failed, entry->text);
+            }
+            fclose(out);
+        }
+    }
+
+    int64_t linesTotal = 0;
+    int maxLine = 0;
+    for (int k = 0; k < profile.count; k++) {
+        linesTotal += profile.lines[k].wallNs;
+        if (profile.lines[k].line > maxLine)
+            maxLine = profile.lines[k].line;
+    }
+    int64_t* previous = compareFile != NULL ? load_profile(compareFile, maxLine) : NULL;
+    qsort(profile.lines, profile.count, sizeof(LineProfile), compare_line_time);
+    printf("%s: %d lines in %.3f s\n", arr[i], profile.count, total / 1e9);
+    printf("  line      wall ms       %%    cpu ms  ok/fail%s  command\n", previous != NULL ? "   delta ms" : "");
+    for (int k = 0; k < profile.count && k < top; k++) {
+        LineProfile* entry = &profile.lines[k];
+        printf("%6d %12.3f %6.1f%% %9.3f %3d/%-4d", entry->line, entry->wallNs / 1e6,
+               linesTotal > 0 ? 100.0 * entry->wallNs / linesTotal : 0.0, entry->cpuNs / 1e6, entry->ok,
+               entry->failed);
+        if (previous != NULL && previous[entry->line] >= 0)
+            printf(" %+10.3f", (entry->wallNs - previous[entry->line]) / 1e6);
+        else if (previous != NULL)
+            printf(" %10s", "new");
+        printf(" %s\n", entry->text);
+    }
+    free(previous);
+    for (int k = 0; k < profile.count; k++)
+        free(profile.lines[k].text);
+    free(profile.lines);
+}
+
 void execute_source_script(const char* filename, Dictionary* dict, int* scriptLine, int* aposCounter) {
+    lastExitStatus = 1;
     if(findEndFile(filename) == 0){
         fprintf(stderr, "ERR\n"); // end of file is nor .sh
         return;
     }
-    FILE* file = fopen(filename, "r");
-    if (file == NULL) {
+    // The epoll/uring backends read the script in large chunks through a LineReader
+    FILE* file = NULL;
+    LineReader* reader = NULL;
+    if (ioBackend == IO_STDIO) {
+        file = fopen(filename, "r");
+    } else {
+        int fd = open(filename, O_RDONLY | O_CLOEXEC);
+        if (fd != -1)
+            reader = reader_open(fd);
+    }
+    if (file == NULL && reader == NULL) {
         perror("Error opening script file");
         return;
     }
 
     succeededCMD++;  // Count the source command itself as successful
+    lastExitStatus = 0;
+    int64_t sourceStart = trace_now();
     //int savingMyCmd = *successCom; // saving the value of success cmd before reading the file
 
-    char line[1024];
-    while (fgets(line, sizeof(line), file) != NULL) {
+    // With read-ahead on, lines come through a queue that prepares the next
+    // ones while each foreground command runs
+    ScriptAhead* ahead = NULL;
+    ScriptAhead* prevAhead = activeAhead;
+    if (ahead_depth() > 0) {
+        ahead = calloc(1, sizeof(ScriptAhead));
+        if (ahead == NULL) {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+        ahead->file = file;
+        ahead->reader = reader;
+        activeAhead = ahead;
+    }
+
+    char line[1024] = "";
+    int fileLine = 0;
+    while (ahead != NULL ? ahead_next_line(ahead, line, sizeof(line)) :
+           file != NULL ? fgets(line, sizeof(line), file) != NULL : reader_next_line(reader, line, sizeof(line))) {
         (*scriptLine)++;    //increment any line script
+        fileLine++;
 
         if((*scriptLine) == 0 && strcmp(line, "#!/bin/bash\n") != 0) {
             fprintf(stderr,"ERR\n");
-            fclose(file);
-            return;
+            break;
         }
         if(line[0] == '#' || line[0] == '\0' || line[0] == '\n') {
             //if(line[0] == '#')
@@ -796,7 +7351,27 @@ void execute_source_script(const char* filename, Dictionary* dict, int* scriptLi
 
         //(*scriptLine)++;
         // Execute the command
-        execute_general(line, dict, aposCounter);
+        ioCommands++;
+        status_update(succeededCMD, lastExitStatus, *scriptLine, alias_count(dict));
+        int64_t lineStart = trace_now();
+        readyLine = ahead != NULL ? ahead->current : NULL;
+        if (activeProfile != NULL) {
+            char text[1024];
+            strcpy(text, line);  // execute_general cuts a trailing &
+            int before = succeededCMD;
+            int64_t cpuStart = children_cpu_ns();
+            int64_t wallStart = now_ns(CLOCK_MONOTONIC);
+            execute_general(line, dict, aposCounter);
+            profile_record(activeProfile, fileLine, text, succeededCMD != before,
+                           now_ns(CLOCK_MONOTONIC) - wallStart, children_cpu_ns() - cpuStart);
+        } else {
+            execute_general(line, dict, aposCounter);
+        }
+        if (lineStart != 0) {
+            char name[32];
+            snprintf(name, sizeof(name), "line %d", *scriptLine);
+            trace_span(name, lineStart, line);
+        }
 
     }
     // put back the value that saved before reading the file
@@ -805,7 +7380,20 @@ void execute_source_script(const char* filename, Dictionary* dict, int* scriptLi
     if(line[0] == '\n')
         (*scriptLine)++;
 
-    fclose(file);
+    readyLine = NULL;
+    if (ahead != NULL) {
+        for (int i = 0; i < READAHEAD_MAX; i++)
+            ahead_release(&ahead->lines[i]);
+        free(ahead);
+        activeAhead = prevAhead;
+    }
+    if (file != NULL) {
+        fclose(file);
+    } else {
+        close(reader->fd);
+        reader_close(reader);
+    }
+    trace_span("source", sourceStart, filename);
 }
 
 int findEndFile (const char* filename){
@@ -886,19 +7474,323 @@ int check_logic_op(char** arr){
     return 0;
 }
 
+// Compound lines: items joined by ;, && and ||, where an item is a simple
+// command, a ( list ) run in a forked subshell or a { list; } run in this
+// shell, each optionally followed by 2> FILE (and & for groups).
+
+// Index just past the quoted string that starts at text[pos]
+size_t skip_quoted(const char* text, size_t pos) {
+    char quote = text[pos++];
+    while (text[pos] && text[pos] != quote)
+        pos++;
+    return text[pos] ? pos + 1 : pos;
+}
+
+// A '{' opens a group only as a word of its own: "{ a; }" but not "{a,b}"
+int is_brace_open(const char* text, size_t pos) {
+    return text[pos] == '{' && (text[pos + 1] == ' ' || text[pos + 1] == '\0');
+}
+
+// A '}' closes a group only where a command could start, after ';' or '{ '
+int is_brace_close(const char* text, size_t pos) {
+    if (text[pos] != '}')
+        return 0;
+    size_t before = pos;
+    while (before > 0 && text[before - 1] == ' ')
+        before--;
+    char next = text[pos + 1];
+    return before > 0 && (text[before - 1] == ';' || text[before - 1] == '{') &&
+           (next == '\0' || next == ' ' || next == ';' || next == ')' || next == '&' || next == '|');
+}
+
+// Whether the line needs the compound executor rather than execute_general
+int is_compound(const char* line) {
+    int commandStart = 1;
+    for (size_t pos = 0; line[pos]; ) {
+        char c = line[pos];
+        if (c == ' ') {
+            pos++;
+            continue;
+        }
+        if (c == ';' || (commandStart && (c == '(' || is_brace_open(line, pos))))
+            return 1;
+        if ((c == '&' || c == '|') && line[pos + 1] == c) {
+            commandStart = 1;
+            pos += 2;
+            continue;
+        }
+        commandStart = 0;
+        pos = c == '"' || c == '\'' ? skip_quoted(line, pos) : pos + 1;
+    }
+    return 0;
+}
+
+// Index of the ')' or '}' closing the group opened at text[open], or -1
+long find_group_end(const char* text, size_t open) {
+    int depth = 0;
+    for (size_t pos = open; text[pos]; ) {
+        char c = text[pos];
+        if (c == '"' || c == '\'') {
+            pos = skip_quoted(text, pos);
+            continue;
+        }
+        if (text[open] == '(') {
+            if (c == '(')
+                depth++;
+            else if (c == ')' && --depth == 0)
+                return (long)pos;
+        } else {
+            if (is_brace_open(text, pos))
+                depth++;
+            else if (is_brace_close(text, pos) && --depth == 0)
+                return (long)pos;
+        }
+        pos++;
+    }
+    return -1;
+}
+
+// Splits a list into items; ops[i] is the operator after items[i]
+// (';', '&' for &&, '|' for ||, or 0 at the end). Returns the count, -1 on a syntax error
+int split_list(const char* text, char*** items, char** ops) {
+    int count = 0, capacity = 8;
+    *items = (char**)malloc(capacity * sizeof(char*));
+    *ops = (char*)malloc(capacity);
+    if (*items == NULL || *ops == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    size_t pos = 0;
+    while (1) {
+        while (text[pos] == ' ')
+            pos++;
+        size_t start = pos;
+        if (text[pos] == '(' || is_brace_open(text, pos)) {
+            long end = find_group_end(text, pos);
+            if (end == -1)
+                break;
+            pos = (size_t)end + 1;
+        }
+        // Up to the next operator
+        while (text[pos] && text[pos] != ';' && !((text[pos] == '&' || text[pos] == '|') && text[pos + 1] == text[pos]))
+            pos = text[pos] == '"' || text[pos] == '\'' ? skip_quoted(text, pos) : pos + 1;
+        size_t end = pos;
+        while (end > start && text[end - 1] == ' ')
+            end--;
+        char op = text[pos] == ';' ? ';' : text[pos];
+        if (end == start) {
+            // Only a ';' may end a list with an empty item
+            if (op == '\0' && (count == 0 || (*ops)[count - 1] == ';'))
+                return count;
+            break;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            *items = (char**)realloc(*items, capacity * sizeof(char*));
+            *ops = (char*)realloc(*ops, capacity);
+            if (*items == NULL || *ops == NULL) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        (*items)[count] = strndup(text + start, end - start);
+        if ((*items)[count] == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        (*ops)[count++] = op;
+        if (op == '\0')
+            return count;
+        pos += op == ';' ? 1 : 2;
+    }
+    for (int i = 0; i < count; i++)
+        free((*items)[i]);
+    return -1;
+}
+
+int run_list(const char* text, Dictionary* dict, int* aposCounter);
+
+// Whether a subshell holding just this item can skip its own fork: a simple
+// command that is not a builtin, so it changes nothing in the shell
+int runs_without_subshell(const char* inner) {
+    char** items;
+    char* ops;
+    int n = split_list(inner, &items, &ops);
+    int simple = n == 1 && items[0][0] != '(' && !is_brace_open(items[0], 0) &&
+                 items[0][strlen(items[0]) - 1] != '&';
+    if (simple) {
+        int count;
+        char** words = split_string(items[0], &count);
+        simple = count > 0 && assignment_name(words[0]) == 0;
+        for (int i = 0; simple && i < BUILTIN_COUNT; i++) {
+            if (strcmp(words[0], builtinNames[i]) == 0)
+                simple = 0;
+        }
+        free_split_string(words);
+    }
+    for (int i = 0; i < n; i++)
+        free(items[i]);
+    free(items);
+    free(ops);
+    return simple;
+}
+
+// Runs a ( ... ) or { ...; } item; returns 1 if it succeeded
+int run_group(const char* item, Dictionary* dict, int* aposCounter) {
+    long end = find_group_end(item, 0);
+    char* inner = strndup(item + 1, end - 1);
+    if (inner == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    // What follows the group: 2> FILE and a final &
+    int count;
+    char** words = split_string(item + end + 1, &count);
+    const char* fileName = NULL;
+    int background = 0, bad = 0;
+    for (int i = 0; i < count && !bad; i++) {
+        if (strcmp(words[i], "2>") == 0 && i + 1 < count && fileName == NULL)
+            fileName = words[++i];
+        else if (strcmp(words[i], "&") == 0 && i == count - 1)
+            background = 1;
+        else
+            bad = 1;
+    }
+    if (bad) {
+        lastExitStatus = 2;
+        fprintf(stderr, "ERR\n");
+        free_split_string(words);
+        free(inner);
+        return 0;
+    }
+
+    // The redirection covers the whole group, subshell included
+    int savedStderr = -1;
+    if (fileName != NULL)
+        redirect_stderr(fileName, &savedStderr);
+
+    int64_t groupStart = trace_now();
+    int ok;
+    if (item[0] == '{' && !background) {
+        ok = run_list(inner, dict, aposCounter);
+    } else if (!background && runs_without_subshell(inner)) {
+        // ( cmd args ): execute_general forks once and execs directly
+        ok = run_list(inner, dict, aposCounter);
+    } else {
+        sigset_t block, prevMask;
+        sigemptyset(&block);
+        sigaddset(&block, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &block, &prevMask);
+        io_flush_output();
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("fork");
+            exit(1);
+        }
+        if (pid == 0) {
+            // Subshell: changes to aliases, variables and counters stay here
+            sigprocmask(SIG_SETMASK, &prevMask, NULL);
+            io_fork_child();
+            traceOut = NULL;  // the parent's buffered events must not be written twice
+            status_detach();
+            activeAhead = NULL;  // the script file belongs to the parent
+            readyLine = NULL;
+            capture_detach();
+            ok = run_list(inner, dict, aposCounter);
+            io_flush_output();
+            _exit(ok ? 0 : lastExitStatus > 0 ? lastExitStatus & 0xff : 1);
+        }
+        if (background) {
+            lastExitStatus = -1;
+            int jobId = add_job(pid, item)->job_id;
+            sigprocmask(SIG_SETMASK, &prevMask, NULL);
+            printf("[%d] %d\n", jobId, pid);
+            ok = 1;
+        } else {
+            int status;
+            io_wait_child(pid, &status);
+            sigprocmask(SIG_SETMASK, &prevMask, NULL);
+            lastExitStatus = decode_status(status);
+            ok = lastExitStatus == 0;
+            if (ok)
+                succeededCMD++;
+        }
+    }
+
+    if (savedStderr != -1) {
+        if (dup2(savedStderr, STDERR_FILENO) == -1) {
+            perror("dup2");
+            exit(1);
+        }
+        close(savedStderr);
+    }
+    trace_span(item[0] == '(' ? "subshell" : "group", groupStart, item);
+    free_split_string(words);
+    free(inner);
+    return ok;
+}
+
+// Runs a simple command item with its own 2> FILE; returns 1 if it succeeded
+int run_simple(char* item, Dictionary* dict, int* aposCounter) {
+    int before = succeededCMD;
+    int count;
+    char** arr = split_string(item, &count);
+    char* fileName = check_redirect(arr, count);
+    if (fileName == NULL) {
+        execute_general(item, dict, aposCounter);
+    } else {
+        int savedStderr = -1;
+        redirect_stderr(fileName, &savedStderr);
+        char* command = separate_befor_2arrow(arr);
+        execute_general(command, dict, aposCounter);
+        free(command);
+        if (dup2(savedStderr, STDERR_FILENO) == -1) {
+            perror("dup2");
+            exit(1);
+        }
+        close(savedStderr);
+    }
+    free_split_string(arr);
+    return succeededCMD != before;
+}
+
+// Runs a list with && / || short-circuiting; returns 1 if the last item run succeeded
+int run_list(const char* text, Dictionary* dict, int* aposCounter) {
+    char** items;
+    char* ops;
+    int n = split_list(text, &items, &ops);
+    if (n == -1) {
+        lastExitStatus = 2;
+        fprintf(stderr, "ERR\n");
+        free(items);
+        free(ops);
+        return 0;
+    }
+    int ok = 1;
+    char prevOp = ';';
+    for (int i = 0; i < n; i++) {
+        if (prevOp == ';' || (prevOp == '&' && ok) || (prevOp == '|' && !ok)) {
+            if (items[i][0] == '(' || is_brace_open(items[i], 0))
+                ok = run_group(items[i], dict, aposCounter);
+            else
+                ok = run_simple(items[i], dict, aposCounter);
+        }
+        prevOp = ops[i];
+        free(items[i]);
+    }
+    free(items);
+    free(ops);
+    return ok;
+}
+
 char* separate_befor_2arrow(char** arr){
     int i =0;
     int totalLenCommand =0;
-    int flag =0;
     //count how many argument for the command
     while(arr[i] != NULL && strcmp(arr[i],"2>") != 0){
         totalLenCommand += strlen(arr[i]) + 1;
         i++;
     }
-    if(arr[0][0] =='(' && arr[i-1][strlen(arr[i-1])-1] ==')'){
-        totalLenCommand -= 2;
-        flag =1;
-    }
     char* argv = (char*)malloc(sizeof(char) * totalLenCommand +1);
     if(argv == NULL){
         perror("malloc");
@@ -909,23 +7801,13 @@ char* separate_befor_2arrow(char** arr){
     i=0;
     argv[0] = '\0';
     while(arr[i] != NULL && strcmp(arr[i],"2>")){
-        if(i==0)
-            if(flag == 1)
-                strcat(argv, arr[i]+1);
-            else
-                strcat(argv,arr[i]);
-        else
-            strcat(argv,arr[i]);
+        strcat(argv,arr[i]);
 
         if (arr[i+1] != NULL && strcmp(arr[i+1], "2>") != 0) {
             strcat(argv, " "); // Add space between arguments
         }
         i++;
     }
-    if(flag == 1)
-        argv[totalLenCommand-1] ='\0';
-    else
-        argv[totalLenCommand] ='\0';
     return argv;
 }
 
@@ -0,0 +1,149 @@
+// minishell-top: lists every running minishell from the status pages the
+// shells publish under /dev/shm, refreshed 10 times a second. The pages are
+// only mapped and read, so watching a shell costs it nothing.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "status_page.h"
+
+#define SHM_DIR "/dev/shm"
+#define MAX_SHELLS 256
+
+int64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Copies a consistent snapshot of a mapped page; returns 0 if the shell kept writing
+int read_page(const StatusPage* page, StatusPage* out) {
+    for (int attempt = 0; attempt < 100; attempt++) {
+        uint32_t seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+        memcpy(out, page, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) == seq)
+            return out->magic == STATUS_PAGE_MAGIC && out->version == STATUS_PAGE_VERSION;
+    }
+    return 0;
+}
+
+// Reads every live shell's page; pages of shells that died without cleaning up are skipped
+int collect(StatusPage* pages, int max) {
+    DIR* dir = opendir(SHM_DIR);
+    if (dir == NULL) {
+        perror(SHM_DIR);
+        exit(EXIT_FAILURE);
+    }
+    int count = 0;
+    struct dirent* entry;
+    size_t prefixLen = strlen(STATUS_PAGE_PREFIX);
+    while ((entry = readdir(dir)) != NULL && count < max) {
+        if (strncmp(entry->d_name, STATUS_PAGE_PREFIX, prefixLen) != 0)
+            continue;
+        pid_t pid = (pid_t)atoi(entry->d_name + prefixLen);
+        if (pid <= 0 || (kill(pid, 0) == -1 && errno == ESRCH))
+            continue;
+        int fd = openat(dirfd(dir), entry->d_name, O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            continue;
+        struct stat st;
+        void* map = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(StatusPage))
+            map = mmap(NULL, sizeof(StatusPage), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+            continue;
+        if (read_page((const StatusPage*)map, &pages[count]) && pages[count].pid == pid)
+            count++;
+        munmap(map, sizeof(StatusPage));
+    }
+    closedir(dir);
+    return count;
+}
+
+int compare_pid(const void* a, const void* b) {
+    return ((const StatusPage*)a)->pid - ((const StatusPage*)b)->pid;
+}
+
+// Formats a duration in ns as 12.3s, 4m05s or 2h10m
+void format_duration(int64_t ns, char* out, size_t size) {
+    int64_t sec = ns / 1000000000;
+    if (ns < 0)
+        snprintf(out, size, "-");
+    else if (sec < 60)
+        snprintf(out, size, "%.1fs", ns / 1e9);
+    else if (sec < 3600)
+        snprintf(out, size, "%ldm%02lds", (long)(sec / 60), (long)(sec % 60));
+    else
+        snprintf(out, size, "%ldh%02ldm", (long)(sec / 3600), (long)(sec / 60 % 60));
+}
+
+void draw(StatusPage* pages, int count, int clear) {
+    int64_t now = now_ns();
+    char up[16], running[16];
+    if (clear)
+        printf("\033[H\033[2J");
+    printf("minishell-top: %d shell%s\n\n", count, count == 1 ? "" : "s");
+    printf("%7s %7s %6s %6s %8s %5s %5s  %s\n", "PID", "UP", "CMDS", "LINE", "ALIASES", "LAST", "JOBS", "FOREGROUND");
+    for (int i = 0; i < count; i++) {
+        StatusPage* page = &pages[i];
+        format_duration(now - page->startTime, up, sizeof(up));
+        printf("%7d %7s %6d %6d %8d %5d %5d  ", page->pid, up, page->succeeded, page->scriptLine,
+               page->aliasCount, page->lastStatus, page->jobCount);
+        if (page->foregroundPid != 0) {
+            format_duration(now - page->foregroundStart, running, sizeof(running));
+            printf("%d %s (%s)\n", page->foregroundPid, page->foreground, running);
+        } else {
+            printf("-\n");
+        }
+        for (int j = 0; j < page->jobCount && j < STATUS_PAGE_JOBS; j++) {
+            StatusJob* job = &page->jobs[j];
+            format_duration(now - job->startTime, running, sizeof(running));
+            printf("%7s [%d] %d %s (%s)\n", "", job->jobId, job->pid, job->command, running);
+        }
+    }
+    fflush(stdout);
+}
+
+void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-n refreshes] [-d milliseconds]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char* argv[]) {
+    long refreshes = -1;   // until interrupted
+    long delayMs = 100;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:d:")) != -1) {
+        if (opt == 'n')
+            refreshes = atol(optarg);
+        else if (opt == 'd')
+            delayMs = atol(optarg);
+        else
+            usage(argv[0]);
+    }
+    if (delayMs <= 0)
+        usage(argv[0]);
+
+    static StatusPage pages[MAX_SHELLS];
+    int clear = isatty(STDOUT_FILENO);
+    struct timespec delay = { delayMs / 1000, (delayMs % 1000) * 1000000 };
+    for (long n = 0; refreshes < 0 || n < refreshes; n++) {
+        if (n > 0)
+            nanosleep(&delay, NULL);
+        int count = collect(pages, MAX_SHELLS);
+        qsort(pages, count, sizeof(StatusPage), compare_pid);
+        draw(pages, count, clear);
+    }
+    return 0;
+}
@@ -1,3 +1,4 @@
 #!/bin/bash
-gcc ex2.c -o ex2 -Wall
+gcc ex2.c -o ex2 -Wall -pthread
+gcc minishell_top.c -o minishell-top -Wall
 ./ex2
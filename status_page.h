@@ -0,0 +1,41 @@
+// Layout of the status page each shell publishes under /dev/shm, shared by
+// ex2.c (the writer) and minishell_top.c (the reader)
+#ifndef STATUS_PAGE_H
+#define STATUS_PAGE_H
+
+#include <stdint.h>
+
+#define STATUS_PAGE_PREFIX "minishell-status."   // followed by the shell's pid
+#define STATUS_PAGE_MAGIC 0x5453534du            // "MSST"
+#define STATUS_PAGE_VERSION 1
+#define STATUS_PAGE_JOBS 64
+#define STATUS_COMMAND_MAX 120
+
+typedef struct StatusJob {
+    int32_t jobId;
+    int32_t pid;
+    int64_t startTime;              // CLOCK_REALTIME, ns
+    char command[STATUS_COMMAND_MAX];
+} StatusJob;
+
+// The shell writes under a seqlock: seq is odd while an update is in progress,
+// and a reader copies the page and retries if seq changed meanwhile
+typedef struct StatusPage {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;
+    int32_t pid;
+    int64_t startTime;              // shell start, CLOCK_REALTIME ns
+    int64_t updated;                // last update, CLOCK_REALTIME ns
+    int32_t succeeded;              // succeededCMD
+    int32_t scriptLine;
+    int32_t aliasCount;
+    int32_t lastStatus;
+    int32_t foregroundPid;          // 0 when no foreground command runs
+    int32_t jobCount;
+    int64_t foregroundStart;
+    char foreground[256];
+    StatusJob jobs[STATUS_PAGE_JOBS];
+} StatusPage;
+
+#endif
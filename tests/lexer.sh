@@ -0,0 +1,50 @@
+#!/bin/bash
+# Checks the words and operator positions lex_split reports for quoting cases
+# that once went wrong; exits nonzero on the first mismatch
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# The shell's main is renamed so a small driver can call lex_split directly
+cat > "$DIR/driver.c" <<DRIVER
+#define main shell_main
+#include "$(cd "$(dirname "$0")/.." && pwd)/ex2.c"
+#undef main
+
+int check(const char* line, const char* expected, int logicOp) {
+    char got[1024] = "";
+    int count = 0;
+    LexInfo info;
+    lex_init();
+    for (int impl = LEX_SCALAR; impl <= lexImpl; impl++) {
+        int saved = lexImpl;
+        lexImpl = impl;
+        char** words = lex_split(line, &count, &info);
+        lexImpl = saved;
+        got[0] = '\0';
+        for (int i = 0; i < count; i++)
+            snprintf(got + strlen(got), sizeof(got) - strlen(got), "%s[%s]", i ? " " : "", words[i]);
+        free_split_string(words);
+        if (strcmp(got, expected) != 0 || info.logicOp != logicOp) {
+            printf("FAIL %-6s %s\n  got      %s (logicOp %d)\n  expected %s (logicOp %d)\n",
+                   lexImplNames[impl], line, got, info.logicOp, expected, logicOp);
+            return 1;
+        }
+    }
+    printf("ok   %s\n", line);
+    return 0;
+}
+
+int main() {
+    int failed = 0;
+    // A lone apostrophe inside a word is a plain character
+    failed |= check("echo don't \"stop me\"", "[echo] [don't] [stop me]", -1);
+    failed |= check("echo it's && echo ok", "[echo] [it's] [&&] [echo] [ok]", 2);
+    // A quote opened inside a word hides the operators up to its match
+    failed |= check("alias x='echo a && echo b'", "[alias] [x='echo] [a] [&&] [echo] [b']", -1);
+    failed |= check("echo 'a && b' && echo c", "[echo] [a && b] [&&] [echo] [c]", 2);
+    return failed;
+}
+DRIVER
+
+gcc "$DIR/driver.c" -o "$DIR/driver" -O2 -pthread || exit 1
+"$DIR/driver"